@@ -0,0 +1,103 @@
+/* include/config.h.  Generated from config.h.in by configure.  */
+/* include/config.h.in.  Generated from configure.ac by autoheader.  */
+
+/* Timeout for reading a request body */
+#define BODY_TIMEOUT_MS 5000
+
+/* Time a worker may take to finish its connections before exiting */
+#define DRAIN_TIMEOUT 30
+
+/* Define to 1 if you have the <dlfcn.h> header file. */
+#define HAVE_DLFCN_H 1
+
+/* Define to 1 if you have the <inttypes.h> header file. */
+#define HAVE_INTTYPES_H 1
+
+/* "Use io_uring based I/O backend" */
+#define HAVE_IO_URING 1
+
+/* "Compile with REST backend" */
+#define HAVE_REST 1
+
+/* "Compile with session management code" */
+#define HAVE_SESSION 1
+
+/* "Compile with static file backend" */
+#define HAVE_STATIC 1
+
+/* Define to 1 if you have the <stdint.h> header file. */
+#define HAVE_STDINT_H 1
+
+/* Define to 1 if you have the <stdio.h> header file. */
+#define HAVE_STDIO_H 1
+
+/* Define to 1 if you have the <stdlib.h> header file. */
+#define HAVE_STDLIB_H 1
+
+/* Define to 1 if you have the <strings.h> header file. */
+#define HAVE_STRINGS_H 1
+
+/* Define to 1 if you have the <string.h> header file. */
+#define HAVE_STRING_H 1
+
+/* Define to 1 if you have the <sys/stat.h> header file. */
+#define HAVE_SYS_STAT_H 1
+
+/* Define to 1 if you have the <sys/types.h> header file. */
+#define HAVE_SYS_TYPES_H 1
+
+/* Define to 1 if you have the <unistd.h> header file. */
+#define HAVE_UNISTD_H 1
+
+/* "Compile with JSON parser" */
+#define JSON_PARSER 1
+
+/* "Compile with JSON serializer" */
+#define JSON_SERIALIZER 1
+
+/* Timeout for HTTP keepalive */
+#define KEEPALIVE_TIMEOUT_MS 2000
+
+/* Define to the sub-directory where libtool stores uninstalled libraries. */
+#define LT_OBJDIR ".libs/"
+
+/* Maximum time sending a response can take */
+#define MAX_FILEXFER_TIMEOUT 7200
+
+/* Maximum requests per connection */
+#define MAX_REQUESTS 1000
+
+/* Timeout for handling a request */
+#define MAX_REQUEST_SECONDS 5
+
+/* Name of package */
+#define PACKAGE "websrv"
+
+/* Define to the address where bug reports for this package should be sent. */
+#define PACKAGE_BUGREPORT "david.oberhollenzer@tele2.at"
+
+/* Define to the full name of this package. */
+#define PACKAGE_NAME "websrv"
+
+/* Define to the full name and version of this package. */
+#define PACKAGE_STRING "websrv 0.1"
+
+/* Define to the one symbol short name of this package. */
+#define PACKAGE_TARNAME "websrv"
+
+/* Define to the home page for this package. */
+#define PACKAGE_URL ""
+
+/* Define to the version of this package. */
+#define PACKAGE_VERSION "0.1"
+
+/* Size of the receive buffer, a request header has to fit into it */
+#define SOCK_BUFFER_SIZE 16384
+
+/* Define to 1 if all of the C90 standard headers exist (not just the ones
+   required in a freestanding environment). This macro is provided for
+   backward compatibility; new code need not use it. */
+#define STDC_HEADERS 1
+
+/* Version number of package */
+#define VERSION "0.1"
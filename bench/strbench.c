@@ -0,0 +1,143 @@
+/*
+    Micro benchmark for building large pages with the string type, e.g.
+    as done for big tables or JSON documents. Compares the old linear
+    growth of the buffer with the current geometric growth, on the heap
+    and in an arena.
+
+    Usage: strbench [<size in MiB> [<iterations>]]
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "arena.h"
+#include "str.h"
+
+/* the way string_append_len used to grow buffers */
+typedef struct
+{
+    size_t used;
+    size_t avail;
+    char* data;
+}
+linear_string;
+
+static int linear_append( linear_string* str, const char* cstr, size_t len )
+{
+    size_t newsize;
+    char* new;
+
+    if( (str->used + len + 1) > str->avail )
+    {
+        newsize = str->used + len + 512;
+
+        if( !(new = realloc( str->data, newsize )) )
+            return 0;
+
+        str->data = new;
+        str->avail = newsize;
+    }
+
+    memcpy( str->data + str->used, cstr, len );
+    str->used += len;
+    str->data[ str->used ] = 0;
+    return 1;
+}
+
+static double now( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* rows of a table, rendered up front to only measure appending */
+#define NUM_ROWS 1024
+
+static char rows[ NUM_ROWS ][ 96 ];
+static size_t row_len[ NUM_ROWS ];
+
+static void make_rows( void )
+{
+    int i;
+
+    for( i = 0; i < NUM_ROWS; ++i )
+    {
+        row_len[i] = sprintf( rows[i], "<tr><td>%d</td><td>user%d</td>"
+                                       "<td>%d@example.com</td></tr>\n",
+                              i, i, i );
+    }
+}
+
+static double bench_linear( size_t size )
+{
+    linear_string str = { 0, 0, NULL };
+    double start = now( );
+    unsigned int i;
+
+    for( i = 0; str.used < size; ++i )
+    {
+        if( !linear_append( &str, rows[i % NUM_ROWS],
+                            row_len[i % NUM_ROWS] ) )
+            exit( EXIT_FAILURE );
+    }
+
+    free( str.data );
+    return now( ) - start;
+}
+
+static double bench_string( size_t size, arena* mem )
+{
+    double start = now( );
+    unsigned int i;
+    string str;
+
+    string_init_arena( &str, mem );
+
+    for( i = 0; str.used < size; ++i )
+    {
+        if( !string_append_len( &str, rows[i % NUM_ROWS],
+                                row_len[i % NUM_ROWS] ) )
+            exit( EXIT_FAILURE );
+    }
+
+    string_cleanup( &str );
+    if( mem )
+        arena_reset( mem );
+    return now( ) - start;
+}
+
+int main( int argc, char** argv )
+{
+    double linear = 0.0, heap = 0.0, inarena = 0.0;
+    size_t size = 4;
+    int i, count = 10;
+    arena mem;
+
+    if( argc > 1 )
+        size = strtoul( argv[1], NULL, 10 );
+    if( argc > 2 )
+        count = atoi( argv[2] );
+
+    size *= 1024 * 1024;
+    arena_init( &mem, 0 );
+    make_rows( );
+
+    for( i = 0; i < count; ++i )
+    {
+        linear += bench_linear( size );
+        heap += bench_string( size, NULL );
+        inarena += bench_string( size, &mem );
+    }
+
+    arena_cleanup( &mem );
+
+    printf( "%lu MiB page, average of %d runs:\n",
+            (unsigned long)(size / (1024 * 1024)), count );
+    printf( "  linear growth: %10.3f ms\n", linear * 1000.0 / count );
+    printf( "  heap:          %10.3f ms\n", heap * 1000.0 / count );
+    printf( "  arena:         %10.3f ms\n", inarena * 1000.0 / count );
+    return EXIT_SUCCESS;
+}
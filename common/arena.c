@@ -0,0 +1,150 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/* alignment of all allocations, enough for any basic type */
+#define ARENA_ALIGN 16
+
+static char* align_ptr( char* ptr )
+{
+    uintptr_t addr = (uintptr_t)ptr;
+
+    return ptr + ((ARENA_ALIGN - (addr % ARENA_ALIGN)) % ARENA_ALIGN);
+}
+
+static arena_block* add_block( arena* a, size_t size )
+{
+    arena_block* b;
+
+    size += ARENA_ALIGN;
+    if( size < a->block_size )
+        size = a->block_size;
+
+    if( !(b = malloc( sizeof(*b) + size )) )
+        return NULL;
+
+    b->size = size;
+    b->used = 0;
+    b->next = a->head;
+    a->head = b;
+    return b;
+}
+
+void arena_init( arena* a, size_t block_size )
+{
+    a->head = NULL;
+    a->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+    a->last = NULL;
+}
+
+void* arena_alloc( arena* a, size_t size )
+{
+    arena_block* b = a->head;
+    char* ptr;
+
+    if( b )
+    {
+        ptr = align_ptr( b->data + b->used );
+
+        if( ptr <= b->data + b->size &&
+            size <= (size_t)(b->data + b->size - ptr) )
+        {
+            goto out;
+        }
+    }
+
+    if( !(b = add_block( a, size )) )
+        return NULL;
+
+    ptr = align_ptr( b->data );
+out:
+    b->used = (ptr - b->data) + size;
+    a->last = ptr;
+    return ptr;
+}
+
+void* arena_realloc( arena* a, void* ptr, size_t oldsize, size_t newsize )
+{
+    arena_block* b = a->head;
+    size_t offset, size;
+    char* new;
+
+    if( !ptr )
+        return arena_alloc( a, newsize );
+
+    if( ptr == a->last &&
+        newsize <= (size_t)(b->data + b->size - (char*)ptr) )
+    {
+        b->used = ((char*)ptr - b->data) + newsize;
+        return ptr;
+    }
+
+    /* a block that holds nothing else can be resized as a whole */
+    if( ptr == a->last && (char*)ptr == align_ptr( b->data ) )
+    {
+        offset = (char*)ptr - b->data;
+        size = newsize + ARENA_ALIGN;
+
+        if( !(b = realloc( b, sizeof(*b) + size )) )
+            return NULL;
+
+        new = align_ptr( b->data );
+        if( (size_t)(new - b->data) != offset )
+            memmove( new, b->data + offset, oldsize );
+
+        b->size = size;
+        b->used = (new - b->data) + newsize;
+        a->head = b;
+        a->last = new;
+        return new;
+    }
+
+    if( !(new = arena_alloc( a, newsize )) )
+        return NULL;
+
+    memcpy( new, ptr, oldsize < newsize ? oldsize : newsize );
+    return new;
+}
+
+void arena_reset( arena* a )
+{
+    arena_block* b;
+
+    if( !a->head )
+        return;
+
+    while( a->head->next )
+    {
+        b = a->head;
+        a->head = b->next;
+        free( b );
+    }
+
+    /* oversized blocks made for a single large allocation are not kept */
+    if( a->head->size > a->block_size )
+    {
+        free( a->head );
+        a->head = NULL;
+    }
+    else
+    {
+        a->head->used = 0;
+    }
+
+    a->last = NULL;
+}
+
+void arena_cleanup( arena* a )
+{
+    arena_block* b;
+
+    while( (b = a->head) )
+    {
+        a->head = b->next;
+        free( b );
+    }
+
+    a->last = NULL;
+}
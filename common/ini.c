@@ -43,7 +43,9 @@ int ini_compile( char* buffer, size_t size )
         }
         else if( isalnum(*in) )
         {
-            while( in < end && isalnum(*in) ) *(out++) = *(in++);
+            while( in < end && (isalnum(*in) ||
+                                (*in && strchr( "_-+./", *in ))) )
+                *(out++) = *(in++);
             if( in >= end || *(in++) != '=' ) goto fail_ass;
             if( in >= end ) goto fail_val;
             *(out++) = '\0';
@@ -23,14 +23,17 @@ typedef struct
     char* out;
     char* end;
     size_t size;
+    arena* mem;     /* scratch memory for arrays, the heap if NULL */
 }
 mem_stream;
 
-static void mem_stream_init( mem_stream* str, char* buffer, size_t size )
+static void mem_stream_init( mem_stream* str, char* buffer, size_t size,
+                             arena* mem )
 {
     str->in = str->out = buffer;
     str->end = buffer + size;
     str->size = size;
+    str->mem = mem;
 }
 
 static int mem_stream_getc( mem_stream* str )
@@ -270,9 +273,19 @@ static int deserialize_array( void** out, size_t* count,
                               const js_struct* desc, mem_stream* str )
 {
     size_t size = 10, used = 0;
-    char *arr = calloc( desc->objsize, size ), *new, *start = str->in;
+    char *arr, *new, *start = str->in;
     int c;
 
+    if( str->mem )
+        arr = arena_alloc( str->mem, size * desc->objsize );
+    else
+        arr = malloc( size * desc->objsize );
+
+    if( !arr )
+        return 0;
+
+    memset( arr, 0, size * desc->objsize );
+
     while( 1 )
     {
         c = mem_stream_getc( str );
@@ -280,8 +293,17 @@ static int deserialize_array( void** out, size_t* count,
 
         if( used > ((3*size)/4) )
         {
+            if( str->mem )
+            {
+                new = arena_realloc( str->mem, arr, size * desc->objsize,
+                                     2 * size * desc->objsize );
+            }
+            else
+            {
+                new = realloc( arr, 2 * size * desc->objsize );
+            }
+            if( !new ) goto fail;
             size *= 2;
-            if( !(new = realloc( arr, size * desc->objsize )) ) goto fail;
             arr = new;
             memset(arr + used*desc->objsize, 0, (size - used)*desc->objsize);
         }
@@ -298,13 +320,15 @@ static int deserialize_array( void** out, size_t* count,
 
     str->end -= desc->objsize * used;
     memcpy( str->end, arr, desc->objsize * used );
-    free( arr );
+    if( !str->mem )
+        free( arr );
 
     *out = str->end;
     *count = used;
     return 1;
 fail:
-    free( arr );
+    if( !str->mem )
+        free( arr );
     return 0;
 }
 
@@ -566,31 +590,31 @@ static int json_preprocess( mem_stream* str )
 /****************************************************************************/
 
 int json_deserialize( void* obj, const js_struct* desc,
-                      char* buffer, size_t size )
+                      char* buffer, size_t size, arena* mem )
 {
     mem_stream str;
 
-    mem_stream_init( &str, buffer, size );
+    mem_stream_init( &str, buffer, size, mem );
     if( !json_preprocess(&str)              ) return 0;
     if( mem_stream_getc(&str)!='{'          ) return 0;
     if( !json_preprocess_object(&str, desc) ) return 0;
 
-    mem_stream_init( &str, buffer+1, str.out-buffer-1 );
+    mem_stream_init( &str, buffer+1, str.out-buffer-1, mem );
     str.end = buffer + size;
     return deserialize( obj, desc, &str );
 }
 
 int json_deserialize_array( void** out, size_t* count, const js_struct* desc,
-                            char* buffer, size_t size )
+                            char* buffer, size_t size, arena* mem )
 {
     mem_stream str;
 
-    mem_stream_init( &str, buffer, size );
+    mem_stream_init( &str, buffer, size, mem );
     if( !json_preprocess(&str)             ) return 0;
     if( mem_stream_getc(&str)!='['         ) return 0;
     if( !json_preprocess_array(&str, desc) ) return 0;
 
-    mem_stream_init( &str, buffer+1, str.out-buffer-1 );
+    mem_stream_init( &str, buffer+1, str.out-buffer-1, mem );
     str.end = buffer + size;
     return deserialize_array( out, count, desc, &str );
 }
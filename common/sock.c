@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
 #include <unistd.h>
@@ -9,9 +10,9 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <ctype.h>
 #include <errno.h>
 
+#include "config.h"
 #include "sock.h"
 #include "log.h"
 
@@ -151,18 +152,96 @@ int wait_for_fd( int fd, long timeoutms )
     return 1;
 }
 
-void splice_to_sock( int* pfd, int filefd, int sockfd,
-                     size_t filesize, size_t pipedata )
+static sock_seg* new_seg( size_t size )
 {
+    sock_seg* seg = malloc( sizeof(*seg) + size );
+
+    if( seg )
+    {
+        seg->next = NULL;
+        seg->filefd = -1;
+        seg->offset = 0;
+        seg->size = size;
+    }
+    return seg;
+}
+
+static void append_seg( sock_t* sock, sock_seg* seg )
+{
+    if( seg->filefd < 0 )
+        sock->queued += seg->size;
+
+    if( sock->out_tail )
+        sock->out_tail->next = seg;
+    else
+        sock->out = seg;
+    sock->out_tail = seg;
+}
+
+static void free_seg( sock_seg* seg )
+{
+    if( seg->filefd >= 0 )
+        close( seg->filefd );
+    free( seg );
+}
+
+/* move data from the front of a pipe to the output queue, drop the rest */
+static int queue_pipe( sock_t* sock, int fd, size_t keep, size_t size )
+{
+    sock_seg* seg = NULL;
+    char buffer[ 4096 ];
+    size_t done = 0;
+    ssize_t ret;
+
+    if( keep > SOCK_QUEUE_MAX - sock->queued )
+        return 0;
+
+    if( keep && !(seg = new_seg( keep )) )
+        return 0;
+
+    while( done < size )
+    {
+        if( done < keep )
+            ret = read( fd, seg->data + done, keep - done );
+        else
+            ret = read( fd, buffer, size - done < sizeof(buffer) ?
+                                    size - done : sizeof(buffer) );
+
+        if( ret < 0 && errno == EINTR )
+            continue;
+
+        if( ret <= 0 )
+        {
+            free( seg );
+            return 0;
+        }
+
+        done += ret;
+    }
+
+    if( seg )
+        append_seg( sock, seg );
+    return 1;
+}
+
+int splice_to_sock( int* pfd, int filefd, sock_t* sock, size_t offset,
+                    size_t filesize, size_t pipedata )
+{
+    size_t prefix = pipedata, sent = 0, keep;
+    loff_t pos = offset;
     ssize_t count;
 
-    while( filesize || pipedata )
+    if( sock->failed )
+        return 1;
+
+    while( !sock->out && (filesize || pipedata) )
     {
         if( filesize )
         {
-            count = splice(filefd, 0, pfd[1], 0, filesize, SPLICE_F_MOVE);
+            count = splice(filefd, &pos, pfd[1], 0, filesize,
+                           SPLICE_F_MOVE);
             if( count<0 )
-                break;
+                goto fail;
             if( count==0 )
                 filesize = 0;
             pipedata += count;
@@ -170,12 +249,75 @@ void splice_to_sock( int* pfd, int filefd, int sockfd,
         }
         if( pipedata )
         {
-            count = splice(pfd[0], 0, sockfd, 0, pipedata, SPLICE_F_MOVE);
-            if( count<=0 )
+            count = splice(pfd[0], 0, sock->fd, 0, pipedata,
+                           SPLICE_F_MOVE | (filesize ? SPLICE_F_MORE : 0));
+            if( count<0 && errno==EAGAIN )
                 break;
+            if( count<=0 )
+                goto fail;
             pipedata -= count;
+            sent += count;
+        }
+    }
+
+    if( !filesize && !pipedata )
+        return 0;
+
+    /*
+        Only the data written to the pipe up front has to be kept in
+        memory, file data left in the pipe is sent from the file again.
+     */
+    keep = prefix > sent ? prefix - sent : 0;
+
+    if( !queue_pipe( sock, pfd[0], keep, pipedata ) )
+        goto fail;
+
+    pipedata -= keep;
+    return !sock_send_file( sock, filefd, pos - pipedata,
+                            filesize + pipedata );
+fail:
+    sock->failed = 1;
+    return 1;
+}
+
+/* advance an I/O vector past the bytes that have been written */
+static void skip_iov( struct iovec** iov, int* count, size_t size )
+{
+    for( ; *count && size >= (*iov)->iov_len; ++(*iov), --(*count) )
+        size -= (*iov)->iov_len;
+
+    if( *count )
+    {
+        (*iov)->iov_base = (char*)(*iov)->iov_base + size;
+        (*iov)->iov_len -= size;
+    }
+}
+
+int write_iov( int fd, struct iovec* iov, int count )
+{
+    ssize_t ret;
+
+    while( count )
+    {
+        ret = writev( fd, iov, count );
+
+        if( ret < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            return 0;
         }
+
+        skip_iov( &iov, &count, ret );
     }
+    return 1;
+}
+
+static int alloc_buffer( sock_t* sock )
+{
+    if( !sock->buffer && !(sock->buffer = malloc( SOCK_BUFFER_SIZE )) )
+        return 0;
+    return 1;
 }
 
 sock_t* create_wrapper( int fd )
@@ -190,7 +332,16 @@ sock_t* create_wrapper( int fd )
 
 void destroy_wrapper( sock_t* sock )
 {
+    sock_seg* seg;
+
+    while( (seg = sock->out) )
+    {
+        sock->out = seg->next;
+        free_seg( seg );
+    }
+
     close( sock->fd );
+    free( sock->buffer );
     free( sock );
 }
 
@@ -207,7 +358,10 @@ int sock_wait( sock_t* sock, long timeoutms )
         return -1;
     }
 
-    diff = read( sock->fd, sock->buffer, sizeof(sock->buffer) );
+    if( !alloc_buffer( sock ) )
+        return -1;
+
+    diff = read( sock->fd, sock->buffer, SOCK_BUFFER_SIZE );
     if( diff == 0 )
         return 0;
     if( diff < 0 )
@@ -218,6 +372,71 @@ int sock_wait( sock_t* sock, long timeoutms )
     return 1;
 }
 
+/* move unread data to the start of the buffer, return the space left */
+static int prepare_append( sock_t* sock )
+{
+    if( !alloc_buffer( sock ) )
+        return -1;
+
+    if( sock->offset )
+    {
+        memmove( sock->buffer, sock->buffer + sock->offset,
+                 sock->size - sock->offset );
+        sock->size -= sock->offset;
+        sock->offset = 0;
+    }
+
+    if( sock->size == SOCK_BUFFER_SIZE )
+    {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    return SOCK_BUFFER_SIZE - sock->size;
+}
+
+int sock_fill( sock_t* sock )
+{
+    ssize_t diff;
+    int avail;
+
+    if( (avail = prepare_append( sock )) < 0 )
+        return -1;
+
+    diff = read( sock->fd, sock->buffer + sock->size, avail );
+    if( diff > 0 )
+        sock->size += diff;
+    return diff;
+}
+
+int sock_append( sock_t* sock, const void* data, size_t size )
+{
+    int avail = prepare_append( sock );
+
+    if( avail < 0 )
+        return 0;
+
+    if( size > (size_t)avail )
+    {
+        errno = ENOBUFS;
+        return 0;
+    }
+
+    memcpy( sock->buffer + sock->size, data, size );
+    sock->size += size;
+    return 1;
+}
+
+void sock_release_buffer( sock_t* sock )
+{
+    if( sock->offset >= sock->size )
+    {
+        free( sock->buffer );
+        sock->buffer = NULL;
+        sock->offset = sock->size = 0;
+    }
+}
+
 ssize_t sock_read( sock_t* sock, void* buffer, size_t size, long timeoutms )
 {
     size_t have = sock->size - sock->offset;
@@ -248,40 +467,164 @@ ssize_t sock_read( sock_t* sock, void* buffer, size_t size, long timeoutms )
     return diff <= 0 ? diff : ((ssize_t)have + diff);
 }
 
-int read_line( sock_t* sock, char* buffer, size_t size, long timeout )
+int sock_send_iov( sock_t* sock, struct iovec* iov, int count )
 {
-    size_t i = 0;
-    char c;
-    int ret;
+    size_t size = 0;
+    sock_seg* seg;
+    ssize_t ret;
+    int i;
+
+    if( sock->failed )
+        return 0;
 
-    while( 1 )
+    while( !sock->out && count )
     {
-        if( sock->offset >= sock->size )
+        ret = writev( sock->fd, iov, count );
+
+        if( ret < 0 )
         {
-            ret = sock_wait( sock, timeout );
-            if( ret <= 0 )
-                return ret;
+            if( errno == EINTR )
+                continue;
+            if( errno == EAGAIN )
+                break;
+            goto fail;
         }
 
-        c = sock->buffer[sock->offset++];
-        if( c == '\t' ) c = ' ';
-        if( c == '\\' ) c = '/';
-        if( c == '\n' ) break;
-        if( isspace(c) && c != ' ' )
-            continue;
-        if( c == '/' && i && buffer[i-1] == '/' )
-            continue;
-        if( c == ' ' && (!i || (buffer[i-1] == ' ')) )
+        skip_iov( &iov, &count, ret );
+    }
+
+    for( i = 0; i < count; ++i )
+        size += iov[i].iov_len;
+
+    if( !size )
+        return 1;
+
+    if( size > SOCK_QUEUE_MAX - sock->queued || !(seg = new_seg( size )) )
+        goto fail;
+
+    for( size = 0, i = 0; i < count; ++i )
+    {
+        memcpy( seg->data + size, iov[i].iov_base, iov[i].iov_len );
+        size += iov[i].iov_len;
+    }
+
+    append_seg( sock, seg );
+    return 1;
+fail:
+    sock->failed = 1;
+    return 0;
+}
+
+int sock_send_file( sock_t* sock, int filefd, off_t offset, size_t size )
+{
+    sock_seg* seg;
+    ssize_t ret;
+
+    if( sock->failed )
+        return 0;
+
+    while( !sock->out && size )
+    {
+        ret = sendfile( sock->fd, filefd, &offset, size );
+
+        if( ret < 0 && errno == EINTR )
             continue;
-        if( i == size )
-            return 0;
-        buffer[i++] = c;
+        if( ret < 0 && errno == EAGAIN )
+            break;
+        if( ret <= 0 )
+            goto fail;
+
+        size -= ret;
     }
 
-    while( i > 0 && isspace(buffer[i - 1]) )
-        --i;
+    if( !size )
+        return 1;
+
+    if( !(seg = new_seg( 0 )) )
+        goto fail;
+
+    /* the caller may close its descriptor before the rest is sent */
+    if( (seg->filefd = fcntl( filefd, F_DUPFD_CLOEXEC, 0 )) < 0 )
+    {
+        free( seg );
+        goto fail;
+    }
 
-    buffer[i] = '\0';
+    seg->offset = offset;
+    seg->size = size;
+    append_seg( sock, seg );
     return 1;
+fail:
+    sock->failed = 1;
+    return 0;
 }
 
+int sock_flush( sock_t* sock )
+{
+    sock_seg* seg;
+    ssize_t ret;
+
+    while( (seg = sock->out) )
+    {
+        if( seg->filefd >= 0 )
+        {
+            ret = sendfile( sock->fd, seg->filefd, &seg->offset, seg->size );
+        }
+        else
+        {
+            ret = write( sock->fd, seg->data + seg->offset, seg->size );
+            if( ret > 0 )
+            {
+                seg->offset += ret;
+                sock->queued -= ret;
+            }
+        }
+
+        if( ret < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            return errno == EAGAIN ? 0 : -1;
+        }
+
+        if( ret == 0 )
+            return -1;
+
+        if( (seg->size -= ret) == 0 )
+        {
+            sock->out = seg->next;
+            free_seg( seg );
+        }
+    }
+
+    sock->out_tail = NULL;
+    return 1;
+}
+
+int sock_consume( sock_t* sock, size_t size )
+{
+    sock_seg* seg;
+    size_t count;
+
+    while( size && (seg = sock->out) )
+    {
+        count = size < seg->size ? size : seg->size;
+
+        if( seg->filefd < 0 )
+            sock->queued -= count;
+
+        seg->offset += count;
+        seg->size -= count;
+        size -= count;
+
+        if( !seg->size )
+        {
+            sock->out = seg->next;
+            free_seg( seg );
+        }
+    }
+
+    if( !sock->out )
+        sock->out_tail = NULL;
+    return sock->out == NULL;
+}
@@ -8,19 +8,47 @@
 
 static const char* mustencode = "!#$&'()*+,/:;=?@[] \t\v\f\r\n";
 
-int string_init( string* str )
+/* get memory for the data of a string, from wherever it belongs */
+static void* str_alloc( string* str, size_t size )
 {
-    str->avail = 512;
-    str->used = 0;
-    str->data = malloc( str->avail );
+    return str->mem ? arena_alloc( str->mem, size ) : malloc( size );
+}
 
-    if( str->data == NULL )
-        return 0;
+static void str_free( string* str )
+{
+    if( str->data != str->small && !str->mem )
+        free( str->data );
+}
 
+int string_init( string* str )
+{
+    return string_init_arena( str, NULL );
+}
+
+int string_init_arena( string* str, arena* mem )
+{
+    str->avail = sizeof(str->small);
+    str->used = 0;
+    str->data = str->small;
+    str->mem = mem;
     str->data[0] = 0;
     return 1;
 }
 
+void string_cleanup( string* str )
+{
+    str_free( str );
+    string_init_arena( str, str->mem );
+}
+
+void string_move( string* dst, string* src )
+{
+    *dst = *src;
+
+    if( src->data == src->small )
+        dst->data = dst->small;
+}
+
 int string_append_len( string* str, const char* cstr, size_t len )
 {
     size_t newsize;
@@ -28,9 +56,25 @@ int string_append_len( string* str, const char* cstr, size_t len )
 
     if( (str->used + len + 1) > str->avail )
     {
-        newsize = str->used + len + 512;
+        /* grow geometrically, so appending is amortized linear */
+        newsize = str->avail * 2;
+        if( newsize < (str->used + len + 1) )
+            newsize = str->used + len + 1;
 
-        new = realloc( str->data, newsize );
+        if( str->data == str->small )
+        {
+            if( !(new = str_alloc( str, newsize )) )
+                return 0;
+            memcpy( new, str->data, str->used + 1 );
+        }
+        else if( str->mem )
+        {
+            new = arena_realloc( str->mem, str->data, str->avail, newsize );
+        }
+        else
+        {
+            new = realloc( str->data, newsize );
+        }
 
         if( !new )
             return 0;
@@ -71,7 +115,7 @@ int string_compress( string* str, int gziphdr )
 
     bound = deflateBound( &strm, str->used );
 
-    if( !(buffer = malloc( bound )) )
+    if( !(buffer = str_alloc( str, bound )) )
     {
         deflateEnd( &strm );
         return 0;
@@ -85,11 +129,12 @@ int string_compress( string* str, int gziphdr )
     if( deflate(&strm, Z_FINISH) != Z_STREAM_END )
     {
         deflateEnd( &strm );
-        free( buffer );
+        if( !str->mem )
+            free( buffer );
         return 0;
     }
 
-    free( str->data );
+    str_free( str );
     str->avail = bound;
     str->used = strm.next_out - buffer;
     str->data = (char*)buffer;
@@ -104,7 +149,7 @@ int string_extract( string* str, int isgzip )
     string temp;
     int ret;
 
-    if( !string_init( &temp ) )
+    if( !string_init_arena( &temp, str->mem ) )
         return 0;
 
     memset( &strm, 0, sizeof(strm) );
@@ -140,8 +185,8 @@ int string_extract( string* str, int isgzip )
 
     /* cleanup */
     inflateEnd( &strm );
-    free( str->data );
-    *str = temp;
+    str_free( str );
+    string_move( str, &temp );
     return 1;
 fail:
     string_cleanup( &temp );
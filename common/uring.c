@@ -0,0 +1,234 @@
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+
+#include "uring.h"
+
+#define LOAD_ACQUIRE( ptr ) __atomic_load_n( (ptr), __ATOMIC_ACQUIRE )
+#define STORE_RELEASE( ptr, val ) __atomic_store_n( (ptr), (val), \
+                                                    __ATOMIC_RELEASE )
+
+int uring_init( uring_t* ring, unsigned int entries )
+{
+    struct io_uring_params p;
+    unsigned char* ptr;
+
+    memset( ring, 0, sizeof(*ring) );
+    memset( &p, 0, sizeof(p) );
+
+    ring->fd = syscall( __NR_io_uring_setup, entries, &p );
+    if( ring->fd < 0 )
+        return 0;
+
+    if( !(p.features & IORING_FEAT_EXT_ARG) )
+        goto fail;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    ring->cq_ring_size = p.cq_off.cqes +
+                         p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if( p.features & IORING_FEAT_SINGLE_MMAP )
+    {
+        if( ring->cq_ring_size > ring->sq_ring_size )
+            ring->sq_ring_size = ring->cq_ring_size;
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap( NULL, ring->sq_ring_size, PROT_READ|PROT_WRITE,
+                          MAP_SHARED|MAP_POPULATE, ring->fd,
+                          IORING_OFF_SQ_RING );
+    if( ring->sq_ring == MAP_FAILED )
+        goto fail;
+
+    if( p.features & IORING_FEAT_SINGLE_MMAP )
+    {
+        ring->cq_ring = ring->sq_ring;
+    }
+    else
+    {
+        ring->cq_ring = mmap( NULL, ring->cq_ring_size, PROT_READ|PROT_WRITE,
+                              MAP_SHARED|MAP_POPULATE, ring->fd,
+                              IORING_OFF_CQ_RING );
+        if( ring->cq_ring == MAP_FAILED )
+            goto fail;
+    }
+
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap( NULL, ring->sqes_size, PROT_READ|PROT_WRITE,
+                       MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES );
+    if( ring->sqes == MAP_FAILED )
+        goto fail;
+
+    ptr = ring->sq_ring;
+    ring->sq_head = (unsigned int*)(ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned int*)(ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned int*)(ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned int*)(ptr + p.sq_off.array);
+    ring->sq_entries = p.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    ptr = ring->cq_ring;
+    ring->cq_head = (unsigned int*)(ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned int*)(ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned int*)(ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(ptr + p.cq_off.cqes);
+    return 1;
+fail:
+    uring_cleanup( ring );
+    return 0;
+}
+
+void uring_cleanup( uring_t* ring )
+{
+    if( ring->sqes && ring->sqes != MAP_FAILED )
+        munmap( ring->sqes, ring->sqes_size );
+    if( ring->cq_ring && ring->cq_ring != MAP_FAILED &&
+        ring->cq_ring != ring->sq_ring )
+    {
+        munmap( ring->cq_ring, ring->cq_ring_size );
+    }
+    if( ring->sq_ring && ring->sq_ring != MAP_FAILED )
+        munmap( ring->sq_ring, ring->sq_ring_size );
+    if( ring->fd >= 0 )
+        close( ring->fd );
+    memset( ring, 0, sizeof(*ring) );
+    ring->fd = -1;
+}
+
+struct io_uring_sqe* uring_get_sqe( uring_t* ring )
+{
+    unsigned int head = LOAD_ACQUIRE( ring->sq_head ), idx;
+    struct io_uring_sqe* sqe;
+
+    if( (ring->sq_local_tail - head) >= ring->sq_entries )
+        return NULL;
+
+    idx = ring->sq_local_tail & *ring->sq_mask;
+    ring->sq_array[ idx ] = idx;
+    ring->sq_local_tail += 1;
+
+    sqe = ring->sqes + idx;
+    memset( sqe, 0, sizeof(*sqe) );
+    return sqe;
+}
+
+int uring_submit( uring_t* ring, unsigned int wait, long timeoutms )
+{
+    struct io_uring_getevents_arg arg;
+    struct __kernel_timespec ts;
+    unsigned int count, flags = 0;
+    void* argptr = NULL;
+    size_t argsize = 0;
+    int ret;
+
+    count = ring->sq_local_tail - LOAD_ACQUIRE( ring->sq_head );
+    STORE_RELEASE( ring->sq_tail, ring->sq_local_tail );
+
+    if( wait )
+    {
+        flags |= IORING_ENTER_GETEVENTS;
+
+        if( timeoutms >= 0 )
+        {
+            memset( &arg, 0, sizeof(arg) );
+            ts.tv_sec = timeoutms / 1000;
+            ts.tv_nsec = (timeoutms % 1000) * 1000000L;
+            arg.sigmask_sz = _NSIG / 8;
+            arg.ts = (unsigned long)&ts;
+
+            flags |= IORING_ENTER_EXT_ARG;
+            argptr = &arg;
+            argsize = sizeof(arg);
+        }
+    }
+
+    ret = syscall( __NR_io_uring_enter, ring->fd, count, wait, flags,
+                   argptr, argsize );
+    return ret < 0 ? -errno : ret;
+}
+
+struct io_uring_cqe* uring_peek_cqe( uring_t* ring )
+{
+    unsigned int head = *ring->cq_head;
+
+    if( head == LOAD_ACQUIRE( ring->cq_tail ) )
+        return NULL;
+
+    return ring->cqes + (head & *ring->cq_mask);
+}
+
+void uring_cqe_seen( uring_t* ring )
+{
+    STORE_RELEASE( ring->cq_head, *ring->cq_head + 1 );
+}
+
+/* wait for the completion of an operation that has been submitted */
+static struct io_uring_cqe* wait_cqe( uring_t* ring )
+{
+    struct io_uring_cqe* cqe;
+    int ret;
+
+    while( !(cqe = uring_peek_cqe( ring )) )
+    {
+        ret = uring_submit( ring, 1, -1 );
+        if( ret < 0 && ret != -EINTR )
+            return NULL;
+    }
+    return cqe;
+}
+
+int uring_has_multishot_accept( uring_t* ring )
+{
+    struct io_uring_sqe *accept, *cancel;
+    sa_family_t family = AF_UNIX;
+    struct io_uring_cqe* cqe;
+    int fd, wait, ret = 0;
+
+    /* binding only the family picks an unused abstract address */
+    if( (fd = socket( AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0 )) < 0 )
+        return 0;
+
+    if( bind( fd, (struct sockaddr*)&family, sizeof(family) ) != 0 ||
+        listen( fd, 1 ) != 0 )
+    {
+        goto out;
+    }
+
+    accept = uring_get_sqe( ring );
+    cancel = uring_get_sqe( ring );
+    if( !accept || !cancel )
+        goto out;
+
+    /* older kernels reject the flag right away, newer ones wait */
+    accept->opcode = IORING_OP_ACCEPT;
+    accept->fd = fd;
+    accept->ioprio = IORING_ACCEPT_MULTISHOT;
+    accept->user_data = 1;
+
+    cancel->opcode = IORING_OP_ASYNC_CANCEL;
+    cancel->addr = 1;
+    cancel->user_data = 2;
+
+    uring_submit( ring, 2, -1 );
+
+    for( wait = 2; wait > 0; --wait )
+    {
+        if( !(cqe = wait_cqe( ring )) )
+        {
+            ret = 0;
+            break;
+        }
+
+        if( cqe->user_data == 1 && cqe->res == -ECANCELED )
+            ret = 1;
+
+        uring_cqe_seen( ring );
+    }
+out:
+    close( fd );
+    return ret;
+}
@@ -0,0 +1,339 @@
+#include "config.h"
+#include "body.h"
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <ctype.h>
+
+/* size of the pieces a body is copied in */
+#define BODY_BUFFER 4096
+
+#define BODY_SIZE 0     /* a chunk size line is received next */
+#define BODY_DATA 1     /* content is received next */
+#define BODY_CRLF 2     /* the line break after a chunk is received next */
+#define BODY_TRAILER 3  /* a trailer line is received next */
+#define BODY_DONE 4     /* the whole body has been received */
+
+static int open_tmpfile( void )
+{
+    return open( P_tmpdir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600 );
+}
+
+/* add content to a body, moving it to a temporary file once it is large */
+static int store( http_body* b, const char* data, size_t size )
+{
+    struct iovec iov[2];
+    int ret;
+
+    iov[0].iov_base = b->data.data;
+    iov[0].iov_len = b->data.used;
+    iov[1].iov_base = (char*)data;
+    iov[1].iov_len = size;
+
+    if( b->fd < 0 && b->size + size > BODY_MEMORY_MAX )
+    {
+        if( (b->fd = open_tmpfile( )) < 0 )
+            return 0;
+
+        ret = write_iov( b->fd, iov, 2 );
+        string_cleanup( &b->data );
+    }
+    else if( b->fd >= 0 )
+    {
+        ret = write_iov( b->fd, iov + 1, 1 );
+    }
+    else
+    {
+        ret = string_append_len( &b->data, data, size );
+    }
+
+    b->size += size;
+    return ret;
+}
+
+/* process a complete line of a chunked body, without the line break */
+static void chunk_line( http_body* b )
+{
+    char* end;
+
+    switch( b->state )
+    {
+    case BODY_CRLF:
+        if( b->line[0] )
+            goto fail;
+        b->state = BODY_SIZE;
+        break;
+    case BODY_SIZE:
+        if( !isxdigit( b->line[0] ) )
+            goto fail;
+
+        /* chunk extensions are ignored */
+        b->left = strtoul( b->line, &end, 16 );
+        if( (*end && *end != ';' && !isspace( *end )) || end - b->line > 15 )
+            goto fail;
+
+        if( b->size + b->left > b->max )
+        {
+            b->error = ERR_SIZE;
+            break;
+        }
+
+        /* the last chunk may be followed by trailer fields */
+        b->state = b->left ? BODY_DATA : BODY_TRAILER;
+        break;
+    case BODY_TRAILER:
+        if( !b->line[0] )
+            b->state = BODY_DONE;
+        break;
+    }
+    return;
+fail:
+    b->error = ERR_BAD_REQ;
+}
+
+void body_init( http_body* b, const http_request* req, arena* mem,
+                unsigned long max )
+{
+    b->chunked = (req->flags & REQ_CHUNKED) != 0;
+    b->state = b->chunked ? BODY_SIZE : BODY_DATA;
+    b->error = 0;
+    b->left = b->chunked ? 0 : req->length;
+    b->max = max;
+    b->limit = 0;
+    b->size = 0;
+    b->pos = 0;
+    b->linelen = 0;
+    b->fd = -1;
+    string_init_arena( &b->data, mem );
+
+    if( b->left > max )
+        b->error = ERR_SIZE;
+}
+
+int body_receive( http_body* b, sock_t* sock )
+{
+    size_t size = sock->buffer ? sock->size - sock->offset : 0, count;
+    const char* data = sock->buffer ? sock->buffer + sock->offset : NULL;
+    int ret = 1;
+    char c;
+
+    while( b->state != BODY_DONE && !b->error )
+    {
+        if( b->state == BODY_DATA )
+        {
+            if( !b->left )
+            {
+                b->state = b->chunked ? BODY_CRLF : BODY_DONE;
+                continue;
+            }
+
+            if( !size )
+                break;
+
+            count = size < b->left ? size : b->left;
+
+            if( !store( b, data, count ) )
+            {
+                b->error = ERR_INTERNAL;
+                break;
+            }
+
+            data += count;
+            size -= count;
+            b->left -= count;
+            continue;
+        }
+
+        if( !size )
+            break;
+
+        c = *(data++);
+        --size;
+
+        if( c != '\n' )
+        {
+            if( b->linelen >= BODY_LINE_MAX - 1 )
+                b->error = ERR_BAD_REQ;
+            else
+                b->line[ b->linelen++ ] = c;
+            continue;
+        }
+
+        if( b->linelen && b->line[b->linelen - 1] == '\r' )
+            --b->linelen;
+
+        b->line[ b->linelen ] = '\0';
+        b->linelen = 0;
+        chunk_line( b );
+    }
+
+    if( sock->buffer )
+        sock->offset = data - sock->buffer;
+
+    if( b->error && b->error != ERR_SIZE )
+        ret = -1;
+    else if( !b->error && b->state != BODY_DONE )
+        ret = 0;
+    return ret;
+}
+
+ssize_t body_read( http_body* b, void* buffer, size_t size )
+{
+    unsigned long left = b->size - b->pos;
+    ssize_t ret;
+
+    if( b->error )
+        return -1;
+
+    if( b->size > b->limit )
+    {
+        b->error = ERR_SIZE;
+        return -1;
+    }
+
+    if( size > left )
+        size = left;
+
+    if( b->fd < 0 )
+    {
+        memcpy( buffer, b->data.data + b->pos, size );
+        ret = size;
+    }
+    else if( (ret = pread( b->fd, buffer, size, b->pos )) < 0 )
+    {
+        b->error = ERR_INTERNAL;
+        return -1;
+    }
+
+    b->pos += ret;
+    return ret;
+}
+
+int body_read_all( http_body* b, string* str )
+{
+    char buffer[ BODY_BUFFER ];
+    ssize_t ret;
+
+    while( (ret = body_read( b, buffer, sizeof(buffer) )) > 0 )
+    {
+        if( !string_append_len( str, buffer, ret ) )
+            return ERR_INTERNAL;
+    }
+
+    return ret < 0 ? b->error : 0;
+}
+
+int body_next_arg( http_body* b, char* buffer, size_t size,
+                   const char** key, const char** value )
+{
+    size_t len = 0;
+    ssize_t ret;
+    char* ptr;
+
+    for( ;; )
+    {
+        if( len >= size - 1 )
+        {
+            b->error = ERR_SIZE;
+            return -1;
+        }
+
+        if( (ret = body_read( b, buffer + len, 1 )) < 0 )
+            return -1;
+
+        if( ret == 0 )
+        {
+            if( !len )
+                return 0;
+            break;
+        }
+
+        if( buffer[len] == '&' )
+        {
+            /* skip empty arguments */
+            if( !len )
+                continue;
+            break;
+        }
+
+        ++len;
+    }
+
+    buffer[ len ] = '\0';
+
+    if( (ptr = strchr( buffer, '=' )) )
+        *(ptr++) = '\0';
+    else
+        ptr = buffer + len;
+
+    http_split_args( buffer );
+    http_split_args( ptr );
+
+    *key = buffer;
+    *value = ptr;
+    return 1;
+}
+
+int body_spill( http_body* b )
+{
+    char buffer[ BODY_BUFFER ];
+    struct iovec iov;
+    ssize_t ret;
+    int fd;
+
+    if( b->fd >= 0 && !b->pos && !b->error && b->size <= b->limit )
+    {
+        b->pos = b->size;
+        fd = b->fd;
+        b->fd = -1;
+
+        if( lseek( fd, 0, SEEK_SET ) == 0 )
+            return fd;
+
+        b->error = ERR_INTERNAL;
+        close( fd );
+        return -1;
+    }
+
+    fd = open_tmpfile( );
+    if( fd < 0 )
+    {
+        b->error = ERR_INTERNAL;
+        return -1;
+    }
+
+    while( (ret = body_read( b, buffer, sizeof(buffer) )) > 0 )
+    {
+        iov.iov_base = buffer;
+        iov.iov_len = ret;
+
+        if( !write_iov( fd, &iov, 1 ) )
+        {
+            b->error = ERR_INTERNAL;
+            goto fail;
+        }
+    }
+
+    if( ret < 0 || lseek( fd, 0, SEEK_SET ) != 0 )
+        goto fail;
+
+    return fd;
+fail:
+    close( fd );
+    return -1;
+}
+
+int body_finish( const http_body* b )
+{
+    return b->state == BODY_DONE;
+}
+
+void body_cleanup( http_body* b )
+{
+    if( b->fd >= 0 )
+        close( b->fd );
+    b->fd = -1;
+}
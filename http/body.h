@@ -0,0 +1,117 @@
+#ifndef BODY_H
+#define BODY_H
+
+#include "http.h"
+#include "sock.h"
+#include "str.h"
+
+/*
+    The body of a request is received completely before the request is
+    handled. Up to this many bytes are received for any request, even if
+    its handler does not read them, so the connection can be kept open.
+    Larger bodies are only received for handlers that accept them, for
+    other handlers the request is handled without its body and the
+    connection is closed after the response.
+ */
+#define BODY_SKIP_MAX (64 * 1024)
+
+/* larger bodies are received into a temporary file instead of memory */
+#define BODY_MEMORY_MAX (16 * 1024)
+
+/* longest chunk size or trailer line accepted in a chunked body */
+#define BODY_LINE_MAX 256
+
+/*
+    Receives the body of a request, sent either with a Content-Length or
+    with chunked transfer encoding, and lets the handler of the request
+    read it. The content is kept in memory, or in an unnamed temporary
+    file once it exceeds BODY_MEMORY_MAX bytes.
+ */
+typedef struct http_body
+{
+    int chunked;            /* non-zero for chunked transfer encoding */
+    int state;              /* what is received next (BODY_* value) */
+    int error;              /* ERR_* value once receiving or reading failed */
+    unsigned long left;     /* bytes left in the body or current chunk */
+    unsigned long max;      /* maximum content size received */
+    unsigned long limit;    /* maximum content size the handler accepts */
+    unsigned long size;     /* content received so far */
+    unsigned long pos;      /* read position in the content */
+    size_t linelen;         /* number of bytes in line */
+    int fd;                 /* temporary file with the content, or -1 */
+    string data;            /* content received so far, if not in a file */
+    char line[ BODY_LINE_MAX ]; /* line of a chunked body being received */
+}
+http_body;
+
+/*
+    Set up a reader for the body of a request, whose content is stored in
+    memory allocated from an arena, up to max bytes. The size limit for
+    reading starts out as zero and has to be raised by whoever handles
+    the request. body_cleanup has to be called once the request has been
+    handled.
+ */
+void body_init( http_body* b, const http_request* req, arena* mem,
+                unsigned long max );
+
+/*
+    Take the body data that has arrived from the receive buffer of a
+    socket, leaving anything that follows the body (i.e. a pipelined
+    request) in the buffer.
+
+    Returns a positive value once the body is complete or turned out to be
+    larger than the maximum (ERR_SIZE in b->error), zero if more data is
+    needed, a negative value on failure, with an ERR_* value in b->error.
+ */
+int body_receive( http_body* b, sock_t* sock );
+
+/*
+    Read up to size bytes of content.
+
+    Returns the number of bytes read, zero at the end of the body, or a
+    negative value on failure, in which case b->error holds an ERR_* value
+    (ERR_SIZE if the body exceeds the limit).
+ */
+ssize_t body_read( http_body* b, void* buffer, size_t size );
+
+/*
+    Append the whole body to a string.
+
+    Returns zero on success, an ERR_* value on failure.
+ */
+int body_read_all( http_body* b, string* str );
+
+/*
+    Read the next argument of a body in application/x-www-form-urlencoded
+    format into a buffer and decode it. Key and value point into the
+    buffer; the value is empty if the argument has none.
+
+    Returns a positive value if an argument was read, zero at the end of
+    the body or a negative value on failure (ERR_SIZE in b->error if an
+    argument does not fit into the buffer).
+ */
+int body_next_arg( http_body* b, char* buffer, size_t size,
+                   const char** key, const char** value );
+
+/*
+    Get the rest of the body in an unnamed temporary file, e.g. to keep
+    an upload. If the body was received into a file and nothing has been
+    read yet, that file is handed out without copying it.
+
+    Returns a file descriptor positioned at the start of the file, which
+    the caller has to close, or -1 on failure.
+ */
+int body_spill( http_body* b );
+
+/*
+    Check if the next request on a connection can be parsed after the
+    current one has been handled, i.e. if its body has been received.
+
+    Returns non-zero if the connection can be used for further requests.
+ */
+int body_finish( const http_body* b );
+
+/* close the temporary file of a body, if there is one */
+void body_cleanup( http_body* b );
+
+#endif /* BODY_H */
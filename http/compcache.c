@@ -0,0 +1,402 @@
+#include "compcache.h"
+#include "sock.h"
+#include "log.h"
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <limits.h>
+#include <dirent.h>
+#include <signal.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <zlib.h>
+
+/* size of the read and write buffers of the compressor */
+#define COMP_BUFFER 65536
+
+/* "<dev>-<ino>-<sec>.<nsec>-<size>.gz", all values in hex */
+#define NAME_LENGTH (5 * 16 + 8)
+
+/* a request to compress a file, sent as one packet */
+typedef struct
+{
+    int dirfd;                  /* directory the path is relative to */
+    char path[ PATH_MAX ];      /* only sent up to the null-terminator */
+}
+comp_job;
+
+/* a compressed copy found while sweeping the cache directory */
+typedef struct
+{
+    time_t mtime;               /* when the copy was created */
+    off_t size;                 /* size of the copy */
+    char name[ NAME_LENGTH ];
+}
+comp_copy;
+
+static int cachefd = -1;        /* directory for compressed copies */
+static int jobfd = -1;          /* where workers send jobs to */
+static long cache_max = 0;      /* space the copies may take up */
+static long cache_used = 0;     /* space they take up, as of the last sweep */
+
+/* compressed copies are named after the original's stat values */
+static void get_name( char* buffer, const struct stat* sb )
+{
+    sprintf( buffer, "%lx-%lx-%lx.%lx-%lx.gz",
+             (unsigned long)sb->st_dev, (unsigned long)sb->st_ino,
+             (unsigned long)sb->st_mtim.tv_sec,
+             (unsigned long)sb->st_mtim.tv_nsec,
+             (unsigned long)sb->st_size );
+}
+
+static int same_file( const struct stat* a, const struct stat* b )
+{
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static int has_suffix( const char* name, const char* suffix )
+{
+    size_t len = strlen( name ), slen = strlen( suffix );
+
+    return len > slen && !strcmp( name + len - slen, suffix );
+}
+
+static int by_age( const void* a, const void* b )
+{
+    const comp_copy* x = a;
+    const comp_copy* y = b;
+
+    return x->mtime < y->mtime ? -1 : (x->mtime > y->mtime ? 1 : 0);
+}
+
+/*
+    Remove temporary files left behind by a compressor that was killed and,
+    if the copies take up too much space, the oldest ones. Files in the
+    directory that the cache did not create are left alone.
+ */
+static void sweep( void )
+{
+    comp_copy *copies = NULL, *new;
+    size_t i, count = 0, max = 0;
+    unsigned long removed = 0;
+    struct dirent* ent;
+    struct stat sb;
+    time_t now;
+    DIR* dir;
+    int fd;
+
+    /* a descriptor of its own, so the read position is not shared */
+    if( (fd = openat( cachefd, ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC )) < 0 )
+        return;
+
+    if( !(dir = fdopendir( fd )) )
+    {
+        close( fd );
+        return;
+    }
+
+    now = time( NULL );
+    cache_used = 0;
+
+    while( (ent = readdir( dir )) )
+    {
+        if( fstatat( cachefd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW ) != 0 ||
+            !S_ISREG(sb.st_mode) )
+        {
+            continue;
+        }
+
+        if( has_suffix( ent->d_name, ".tmp" ) &&
+            strstr( ent->d_name, ".gz." ) )
+        {
+            if( sb.st_mtime < now - COMPCACHE_TMP_AGE &&
+                unlinkat( cachefd, ent->d_name, 0 ) == 0 )
+            {
+                ++removed;
+            }
+            continue;
+        }
+
+        if( !has_suffix( ent->d_name, ".gz" ) ||
+            strlen( ent->d_name ) >= NAME_LENGTH )
+        {
+            continue;
+        }
+
+        if( count == max )
+        {
+            max = max ? max * 2 : 64;
+            if( !(new = realloc( copies, max * sizeof(copies[0]) )) )
+                goto out;
+            copies = new;
+        }
+
+        copies[count].mtime = sb.st_mtime;
+        copies[count].size = sb.st_size;
+        strcpy( copies[count].name, ent->d_name );
+        cache_used += sb.st_size;
+        ++count;
+    }
+
+    if( cache_max && cache_used > cache_max )
+    {
+        qsort( copies, count, sizeof(copies[0]), by_age );
+
+        for( i = 0; i < count && cache_used > cache_max / 4 * 3; ++i )
+        {
+            if( unlinkat( cachefd, copies[i].name, 0 ) == 0 )
+            {
+                cache_used -= copies[i].size;
+                ++removed;
+            }
+        }
+    }
+out:
+    if( removed )
+        INFO( "compression cache: removed %lu files", removed );
+    free( copies );
+    closedir( dir );
+}
+
+static int deflate_file( int in, int out )
+{
+    static unsigned char inbuf[ COMP_BUFFER ], outbuf[ COMP_BUFFER ];
+    int ret, flush = Z_NO_FLUSH;
+    struct iovec iov;
+    z_stream strm;
+    ssize_t count;
+
+    memset( &strm, 0, sizeof(strm) );
+
+    if( deflateInit2( &strm, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                      Z_DEFAULT_STRATEGY ) != Z_OK )
+    {
+        return 0;
+    }
+
+    while( flush != Z_FINISH )
+    {
+        if( (count = read( in, inbuf, sizeof(inbuf) )) < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            goto fail;
+        }
+
+        flush = count ? Z_NO_FLUSH : Z_FINISH;
+        strm.next_in = inbuf;
+        strm.avail_in = count;
+
+        do
+        {
+            strm.next_out = outbuf;
+            strm.avail_out = sizeof(outbuf);
+
+            ret = deflate( &strm, flush );
+            if( ret == Z_STREAM_ERROR )
+                goto fail;
+
+            iov.iov_base = outbuf;
+            iov.iov_len = sizeof(outbuf) - strm.avail_out;
+
+            if( iov.iov_len && !write_iov( out, &iov, 1 ) )
+                goto fail;
+        }
+        while( strm.avail_out == 0 );
+    }
+
+    deflateEnd( &strm );
+    return 1;
+fail:
+    deflateEnd( &strm );
+    return 0;
+}
+
+static void compress_file( int dirfd, const char* path )
+{
+    char name[ NAME_LENGTH ], temp[ NAME_LENGTH + 32 ];
+    struct stat sb, after;
+    int fd, out;
+
+    if( (fd = openat( dirfd, path, O_RDONLY|O_CLOEXEC )) < 0 )
+        return;
+
+    if( fstat( fd, &sb ) != 0 || !S_ISREG(sb.st_mode) )
+        goto out;
+
+    if( sb.st_size < COMPCACHE_MIN_SIZE || sb.st_size > COMPCACHE_MAX_SIZE )
+        goto out;
+
+    /* the same file may have been queued by several workers */
+    get_name( name, &sb );
+    if( faccessat( cachefd, name, F_OK, 0 ) == 0 )
+        goto out;
+
+    sprintf( temp, "%s.%ld.tmp", name, (long)getpid( ) );
+
+    out = openat( cachefd, temp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644 );
+    if( out < 0 )
+    {
+        WARN( "compression cache: %s: %s", temp, strerror(errno) );
+        goto out;
+    }
+
+    /* only publish the copy if the file did not change in the meantime */
+    if( !deflate_file( fd, out ) || fstat( fd, &after ) != 0 ||
+        !same_file( &sb, &after ) )
+    {
+        close( out );
+        unlinkat( cachefd, temp, 0 );
+        goto out;
+    }
+
+    if( fstat( out, &after ) != 0 )
+        after.st_size = 0;
+
+    close( out );
+
+    if( renameat( cachefd, temp, cachefd, name ) != 0 )
+    {
+        unlinkat( cachefd, temp, 0 );
+        goto out;
+    }
+
+    INFO( "compressed %s", path );
+
+    cache_used += after.st_size;
+    if( cache_max && cache_used > cache_max )
+        sweep( );
+out:
+    close( fd );
+}
+
+static void compressor_main( int fd )
+{
+    struct sigaction act;
+    comp_job job;
+    sigset_t mask;
+    ssize_t ret;
+
+    /* terminate on signals, but do not react to reloads */
+    memset( &act, 0, sizeof(act) );
+    act.sa_handler = SIG_DFL;
+    sigaction( SIGTERM, &act, NULL );
+    sigaction( SIGINT, &act, NULL );
+    sigaction( SIGCHLD, &act, NULL );
+    act.sa_handler = SIG_IGN;
+    sigaction( SIGHUP, &act, NULL );
+
+    sigemptyset( &mask );
+    sigprocmask( SIG_SETMASK, &mask, NULL );
+
+    sweep( );
+
+    /* a zero length read means all workers and the supervisor are gone */
+    while( (ret = recv( fd, &job, sizeof(job), 0 )) != 0 )
+    {
+        if( ret < 0 )
+        {
+            if( errno == EINTR )
+                continue;
+            break;
+        }
+
+        if( ret <= (ssize_t)offsetof(comp_job, path) )
+            continue;
+
+        job.path[ ret - offsetof(comp_job, path) - 1 ] = '\0';
+        compress_file( job.dirfd, job.path );
+    }
+}
+
+/****************************************************************************/
+
+int compcache_init( const char* dir, long maxsize )
+{
+    int sv[2];
+    pid_t pid;
+
+    compcache_cleanup( );
+
+    if( !dir )
+        return 1;
+
+    if( (cachefd = open( dir, O_RDONLY|O_DIRECTORY|O_CLOEXEC )) < 0 )
+    {
+        WARN( "compression cache: %s: %s", dir, strerror(errno) );
+        return 0;
+    }
+
+    if( socketpair( AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv ) != 0 )
+        goto fail;
+
+    cache_max = maxsize;
+
+    if( (pid = fork( )) < 0 )
+    {
+        close( sv[0] );
+        close( sv[1] );
+        goto fail;
+    }
+
+    if( pid == 0 )
+    {
+        close( sv[0] );
+        compressor_main( sv[1] );
+        exit( EXIT_SUCCESS );
+    }
+
+    close( sv[1] );
+    jobfd = sv[0];
+    return 1;
+fail:
+    WARN( "compression cache: %s", strerror(errno) );
+    close( cachefd );
+    cachefd = -1;
+    return 0;
+}
+
+void compcache_cleanup( void )
+{
+    if( jobfd >= 0 )
+        close( jobfd );
+    if( cachefd >= 0 )
+        close( cachefd );
+
+    jobfd = cachefd = -1;
+}
+
+int compcache_open( const struct stat* sb )
+{
+    char name[ NAME_LENGTH ];
+
+    if( cachefd < 0 )
+        return -1;
+
+    get_name( name, sb );
+    return openat( cachefd, name, O_RDONLY|O_CLOEXEC );
+}
+
+int compcache_queue( int dirfd, const char* path )
+{
+    size_t len = strlen( path );
+    comp_job job;
+
+    if( jobfd < 0 || len >= sizeof(job.path) )
+        return 0;
+
+    job.dirfd = dirfd;
+    memcpy( job.path, path, len + 1 );
+
+    return send( jobfd, &job, offsetof(comp_job, path) + len + 1,
+                 MSG_DONTWAIT | MSG_NOSIGNAL ) > 0;
+}
@@ -0,0 +1,49 @@
+#ifndef COMPCACHE_H
+#define COMPCACHE_H
+
+#include <sys/stat.h>
+
+/* files smaller than this are not worth compressing */
+#define COMPCACHE_MIN_SIZE 256
+
+/* files larger than this are not compressed in the background */
+#define COMPCACHE_MAX_SIZE (64L * 1024 * 1024)
+
+/* temporary files that have not been written to for this long are stale */
+#define COMPCACHE_TMP_AGE 600
+
+/*
+    Set up a directory for gzip compressed copies of static files and start
+    a background process that creates them. Has to be called before forking
+    the workers. The background process exits once the cache is cleaned up
+    and all workers that could queue jobs for it are gone.
+
+    When it starts, and whenever the copies take up more than maxsize bytes
+    (unless that is 0), the background process removes the least recently
+    created copies until they fit into three quarters of that, as well as
+    left over temporary files.
+
+    If dir is NULL, the compression cache is disabled.
+
+    Returns non-zero on success, zero on failure.
+ */
+int compcache_init( const char* dir, long maxsize );
+
+/* stop accepting jobs in the calling process and close the directory */
+void compcache_cleanup( void );
+
+/*
+    Open the compressed copy of a file, identified by the stat result of
+    the original. Returns a file descriptor or -1 if there is none (yet).
+ */
+int compcache_open( const struct stat* sb );
+
+/*
+    Ask the background process to create a compressed copy of a file. Does
+    not block: if the job queue is full, the request is dropped.
+
+    Returns non-zero if the request was queued.
+ */
+int compcache_queue( int dirfd, const char* path );
+
+#endif /* COMPCACHE_H */
@@ -14,6 +14,8 @@
 
 static cfg_host* hosts = NULL;
 static cfg_socket* sockets = NULL;
+static cfg_mime* mimes = NULL;
+static cfg_level* levels = NULL;
 static char* conf_buffer = NULL;
 static size_t conf_size = 0;
 
@@ -25,6 +27,10 @@ static struct
 }
 user;
 
+static cfg_workers workers;
+static cfg_cache cache = { -1, -1, -1, -1, -1, NULL, -1, -1 };
+static cfg_compress compress = { -1, -1, NULL };
+
 static cfg_host* get_host_by_name( const char* hostname )
 {
     cfg_host* h;
@@ -47,10 +53,13 @@ static char* fix_vpath( char* value )
 
 int config_read( const char* filename )
 {
+    cfg_mime *m, **mime_tail = &mimes;
+    cfg_level *l, **level_tail = &levels;
     char *key, *value, *end;
     struct stat sb;
     cfg_socket* s;
     cfg_host* h;
+    long count, limit = 0;
     int fd = -1;
 
     if( stat( filename, &sb ) != 0 )
@@ -128,6 +137,150 @@ int config_read( const char* filename )
                 }
             }
         }
+        else if( !strcmp( key, "workers" ) )
+        {
+            while( ini_next_key( &key, &value ) )
+            {
+                if( !strcmp( key, "count" ) )
+                {
+                    count = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) )
+                        goto fail_num;
+                    if( count < 1 || count > MAX_WORKERS )
+                        goto fail_workers;
+                    workers.count = count;
+                }
+                else if( !strcmp( key, "connections" ) )
+                {
+                    count = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) )
+                        goto fail_num;
+                    if( count < 1 || count > MAX_CONNECTIONS )
+                        goto fail_connections;
+                    workers.connections = count;
+                }
+            }
+        }
+        else if( !strcmp( key, "cache" ) )
+        {
+            while( ini_next_key( &key, &value ) )
+            {
+                if( !strcmp( key, "files" ) )
+                {
+                    count = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) )
+                        goto fail_num;
+                    if( count < 0 || count > (limit = MAX_CACHE_FILES) )
+                        goto fail_range;
+                    cache.files = count;
+                }
+                else if( !strcmp( key, "ttl" ) )
+                {
+                    count = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) )
+                        goto fail_num;
+                    if( count < 0 || count > (limit = MAX_CACHE_TTL) )
+                        goto fail_range;
+                    cache.ttl = count;
+                }
+                else if( !strcmp( key, "max_size" ) )
+                {
+                    cache.max_size = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) || cache.max_size < 0 )
+                        goto fail_num;
+                }
+                else if( !strcmp( key, "memory" ) )
+                {
+                    cache.memory = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) || cache.memory < 0 )
+                        goto fail_num;
+                }
+                else if( !strcmp( key, "shared" ) )
+                {
+                    cache.shared = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) || cache.shared < 0 )
+                        goto fail_num;
+                }
+                else if( !strcmp( key, "compress_dir" ) )
+                {
+                    cache.compress_dir = value;
+                }
+                else if( !strcmp( key, "misses" ) )
+                {
+                    count = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) )
+                        goto fail_num;
+                    if( count < 0 || count > (limit = MAX_CACHE_MISSES) )
+                        goto fail_range;
+                    cache.misses = count;
+                }
+                else if( !strcmp( key, "compress_max" ) )
+                {
+                    cache.compress_max = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) ||
+                        cache.compress_max < 0 )
+                    {
+                        goto fail_num;
+                    }
+                }
+            }
+        }
+        else if( !strcmp( key, "mime" ) )
+        {
+            /* kept in file order, so later entries for an extension win */
+            while( ini_next_key( &key, &value ) )
+            {
+                if( !(m = calloc( 1, sizeof(*m) )) )
+                    goto fail_alloc;
+
+                *mime_tail = m;
+                mime_tail = &m->next;
+
+                while( *key == '.' )
+                    ++key;
+
+                m->ext = key;
+                m->type = value;
+            }
+        }
+        else if( !strcmp( key, "compress" ) )
+        {
+            while( ini_next_key( &key, &value ) )
+            {
+                if( !strcmp( key, "min_size" ) )
+                {
+                    compress.min_size = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) )
+                        goto fail_num;
+                    if( compress.min_size < 0 )
+                        goto fail_num;
+                }
+                else if( !strcmp( key, "level" ) )
+                {
+                    compress.level = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) )
+                        goto fail_num;
+                    if( compress.level < 0 || compress.level > 9 )
+                        goto fail_level;
+                }
+                else if( strchr( key, '/' ) )
+                {
+                    /* kept in file order, the first matching entry wins */
+                    if( !(l = calloc( 1, sizeof(*l) )) )
+                        goto fail_alloc;
+
+                    *level_tail = l;
+                    level_tail = &l->next;
+
+                    l->type = key;
+                    l->level = strtol( value, &end, 10 );
+                    if( end == value || (end && *end) )
+                        goto fail_num;
+                    if( l->level < 0 || l->level > 9 )
+                        goto fail_level;
+                }
+            }
+        }
         else if( !strcmp(key,"ipv4") || !strcmp(key,"ipv6") ||
                  !strcmp(key,"unix") )
         {
@@ -160,6 +313,44 @@ int config_read( const char* filename )
         }
     }
 
+    if( !workers.count )
+    {
+        count = sysconf( _SC_NPROCESSORS_ONLN );
+        workers.count = count > 0 ? count : 1;
+    }
+
+    if( !workers.connections )
+        workers.connections = 1024;
+
+    if( cache.files < 0 )
+        cache.files = 128;
+
+    if( cache.ttl < 0 )
+        cache.ttl = 5;
+
+    if( cache.max_size < 0 )
+        cache.max_size = 16384;
+
+    if( cache.memory < 0 )
+        cache.memory = 4L * 1024 * 1024;
+
+    if( cache.shared < 0 )
+        cache.shared = 16L * 1024 * 1024;
+
+    if( cache.misses < 0 )
+        cache.misses = 256;
+
+    if( cache.compress_max < 0 )
+        cache.compress_max = 256L * 1024 * 1024;
+
+    if( compress.min_size < 0 )
+        compress.min_size = 256;
+
+    if( compress.level < 0 )
+        compress.level = 6;
+
+    compress.types = levels;
+
     return 1;
 fail_open:
     CRITICAL( "%s: %s", filename, strerror(errno) );
@@ -177,6 +368,19 @@ fail_num:
 fail_port:
     CRITICAL( "%s: %s", filename, "Port must be in range [0, 65535]" );
     return 0;
+fail_level:
+    CRITICAL( "%s: %s", key, "Compression level must be in range [0, 9]" );
+    return 0;
+fail_workers:
+    CRITICAL( "%s: Worker count must be in range [1, %d]", key, MAX_WORKERS );
+    return 0;
+fail_connections:
+    CRITICAL( "%s: Connection limit must be in range [1, %d]",
+              key, MAX_CONNECTIONS );
+    return 0;
+fail_range:
+    CRITICAL( "%s: Value must be in range [0, %ld]", key, limit );
+    return 0;
 }
 
 cfg_host* config_find_host( const char* hostname )
@@ -207,15 +411,42 @@ int config_set_user( void )
     return 1;
 }
 
+cfg_host* config_get_hosts( void )
+{
+    return hosts;
+}
+
 cfg_socket* config_get_sockets( void )
 {
     return sockets;
 }
 
+const cfg_workers* config_get_workers( void )
+{
+    return &workers;
+}
+
+const cfg_cache* config_get_cache( void )
+{
+    return &cache;
+}
+
+const cfg_mime* config_get_mime( void )
+{
+    return mimes;
+}
+
+const cfg_compress* config_get_compress( void )
+{
+    return &compress;
+}
+
 void config_cleanup( void )
 {
     cfg_socket* s;
     cfg_host* h;
+    cfg_level* l;
+    cfg_mime* m;
 
     while( hosts != NULL )
     {
@@ -235,9 +466,38 @@ void config_cleanup( void )
         free( s );
     }
 
+    while( mimes != NULL )
+    {
+        m = mimes;
+        mimes = mimes->next;
+
+        free( m );
+    }
+
+    while( levels != NULL )
+    {
+        l = levels;
+        levels = levels->next;
+
+        free( l );
+    }
+
     if( conf_buffer && conf_size )
         munmap( conf_buffer, conf_size );
 
     user.is_set = 0;
+    workers.count = 0;
+    workers.connections = 0;
+    cache.files = -1;
+    cache.ttl = -1;
+    cache.max_size = -1;
+    cache.memory = -1;
+    cache.shared = -1;
+    cache.compress_dir = NULL;
+    cache.misses = -1;
+    cache.compress_max = -1;
+    compress.min_size = -1;
+    compress.level = -1;
+    compress.types = NULL;
 }
 
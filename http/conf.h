@@ -22,18 +22,86 @@ typedef struct cfg_socket
 }
 cfg_socket;
 
+/* upper limits for the [workers] section */
+#define MAX_WORKERS 1024
+#define MAX_CONNECTIONS 65536
+
+typedef struct
+{
+    unsigned int count;         /* number of prefork worker processes */
+    unsigned int connections;   /* maximum connections per worker */
+}
+cfg_workers;
+
+/* upper limits for the [cache] section */
+#define MAX_CACHE_FILES 65536
+#define MAX_CACHE_TTL 86400
+#define MAX_CACHE_MISSES 65536
+
+typedef struct
+{
+    int files;      /* number of open files to keep around per worker */
+    int ttl;        /* seconds until a cached file is looked up again */
+    long max_size;  /* maximum size of a file to keep in memory */
+    long memory;    /* memory budget per worker for files kept in memory */
+    long shared;    /* size of the memory segment shared by all workers */
+    const char* compress_dir;   /* if set, where compressed copies go */
+    int misses;     /* number of missing paths to remember per worker */
+    long compress_max;  /* space for compressed copies, 0 for no limit */
+}
+cfg_cache;
+
+typedef struct cfg_mime
+{
+    struct cfg_mime* next;
+    const char* ext;    /* file extension, without the dot */
+    const char* type;   /* content type sent for files with it */
+}
+cfg_mime;
+
+typedef struct cfg_level
+{
+    struct cfg_level* next;
+    const char* type;   /* content type, or prefix of it ending with '/' */
+    int level;          /* compression level, 0 to send it as is */
+}
+cfg_level;
+
+typedef struct
+{
+    long min_size;              /* smaller bodies are sent as is */
+    int level;                  /* level used for other content types */
+    const cfg_level* types;     /* levels for specific content types */
+}
+cfg_compress;
+
 /* read global config from file, return 0 on failure, non-zero on success */
 int config_read( const char* filename );
 
 /* get the host config for a certain host name */
 cfg_host* config_find_host( const char* hostname );
 
+/* get a list of all host configurations */
+cfg_host* config_get_hosts( void );
+
 /* chroot and drop priviledges */
 int config_set_user( void );
 
 /* get a list of all socket configurations */
 cfg_socket* config_get_sockets( void );
 
+/* get the worker pool configuration */
+const cfg_workers* config_get_workers( void );
+
+/* get the static file cache configuration */
+const cfg_cache* config_get_cache( void );
+
+/* get the content types configured for file extensions, in file order */
+const cfg_mime* config_get_mime( void );
+
+/* get the configuration for compressing dynamic responses */
+const cfg_compress* config_get_compress( void );
+
 /* free all memory of the internal config */
 void config_cleanup( void );
 
@@ -1,7 +1,12 @@
 #include "config.h"
 #include "file.h"
 #include "http.h"
+#include "conf.h"
 #include "sock.h"
+#include "shcache.h"
+#include "precomp.h"
+#include "mime.h"
+#include "compcache.h"
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -9,89 +14,657 @@
 #include <string.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stdio.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 
 #ifdef HAVE_STATIC
-static struct {const char* ending; const char* mime; int flags;} mimemap[] =
-{
-    { "js",   "application/javascript; charset=utf-8", FLAG_STATIC },
-    { "json", "application/json; charset=utf-8", FLAG_STATIC       },
-    { "xml",  "application/xml; charset=utf-8", FLAG_STATIC        },
-    { "html", "text/html; charset=utf-8", FLAG_STATIC              },
-    { "htm",  "text/html; charset=utf-8", FLAG_STATIC              },
-    { "css",  "text/css; charset=utf-8", FLAG_STATIC               },
-    { "csv",  "text/csv; charset=utf-8", FLAG_STATIC               },
-    { "pdf",  "application/pdf", FLAG_STATIC_RESOURCE              },
-    { "zip",  "application/zip", FLAG_STATIC_RESOURCE              },
-    { "gz",   "application/gzip", FLAG_STATIC_RESOURCE             },
-    { "png",  "image/png", FLAG_STATIC_RESOURCE                    },
-    { "bmp",  "image/bmp", FLAG_STATIC_RESOURCE                    },
-    { "jpg",  "image/jpeg", FLAG_STATIC_RESOURCE                   },
-    { "jpeg", "image/jpeg", FLAG_STATIC_RESOURCE                   },
-    { "tiff", "image/tiff", FLAG_STATIC_RESOURCE                   },
-    { "txt",  "text/plain; charset=utf-8", FLAG_STATIC_RESOURCE    },
-    { "ico",  "image/x-icon", FLAG_STATIC_RESOURCE                 },
-    { "h",    "text/x-c; charset=utf-8", FLAG_STATIC_RESOURCE      },
-    { "c",    "text/x-c; charset=utf-8", FLAG_STATIC_RESOURCE      },
-    { "cxx",  "text/x-xxc; charset=utf-8", FLAG_STATIC_RESOURCE    },
-};
-
-static void guess_type( const char* name, http_file_info* info )
-{
-    size_t i, count;
-
-    info->type = "application/octet-stream";
-    info->flags = FLAG_STATIC_RESOURCE;
-
-    if( !(name = strrchr( name, '.' )) )
+/* upper limit for growing the transfer pipe (default pipe-max-size) */
+#define XFER_PIPE_MAX (1024 * 1024)
+
+/* room for the response header when sizing the pipe */
+#define HEADER_RESERVE 512
+
+/* largest response header that can be put into the pipe */
+#define HEADER_MAX 1024
+
+/* buffer size for the header of one part of a multipart/byteranges body */
+#define PART_HEADER_MAX 256
+
+/*
+    Pipe used for all file transfers of a worker, created on first use and
+    only thrown away if a transfer is aborted with data left in it.
+ */
+static int xfer_pipe[2] = { -1, -1 };
+static size_t xfer_pipe_size = 0;
+
+static void drop_pipe( void )
+{
+    if( xfer_pipe[0] >= 0 )
+    {
+        close( xfer_pipe[0] );
+        close( xfer_pipe[1] );
+    }
+    xfer_pipe[0] = xfer_pipe[1] = -1;
+    xfer_pipe_size = 0;
+}
+
+/* get the transfer pipe, grown (if possible) to hold size bytes at once */
+static int* get_pipe( size_t size )
+{
+    int ret;
+
+    if( xfer_pipe[0] < 0 )
+    {
+        if( pipe2( xfer_pipe, O_CLOEXEC ) != 0 )
+            return NULL;
+        ret = fcntl( xfer_pipe[1], F_GETPIPE_SZ );
+        xfer_pipe_size = ret > 0 ? ret : 0;
+    }
+
+    if( size > xfer_pipe_size && xfer_pipe_size < XFER_PIPE_MAX )
+    {
+        size = size < XFER_PIPE_MAX ? size : XFER_PIPE_MAX;
+        ret = fcntl( xfer_pipe[1], F_SETPIPE_SZ, (int)size );
+        if( ret > 0 )
+            xfer_pipe_size = ret;
+    }
+
+    return xfer_pipe;
+}
+
+/* where the content of a cached file comes from */
+#define SRC_PLAIN 0     /* the requested file itself */
+#define SRC_GZIP 1      /* a precompressed .gz file next to it */
+#define SRC_PACKED 2    /* a copy from the compression cache */
+#define SRC_PENDING 3   /* the file itself, a compressed copy was requested */
+
+/*
+    An open static file, together with the response information derived
+    from it. Each worker keeps the most recently used ones in a hash table
+    with an LRU list, keyed by directory, path and whether gzip is accepted.
+ */
+typedef struct file_entry
+{
+    struct file_entry* prev;    /* more recently used entry */
+    struct file_entry* next;    /* less recently used entry */
+    struct file_entry* chain;   /* next entry in the same hash bucket */
+    unsigned long hash;         /* hash value of the key */
+    long expires;               /* monotonic time in seconds to drop it */
+    int dirfd;                  /* directory the path is relative to */
+    int gzip;                   /* non-zero if the client accepted gzip */
+    int fd;                     /* the opened file (possibly the .gz one) */
+    int source;                 /* where the content comes from (SRC_*) */
+    dev_t dev;                  /* device of the file that is checked */
+    ino_t ino;                  /* inode of the file that is checked */
+    unsigned long size;         /* size of the file that is checked */
+    long mtime_ns;              /* nanoseconds of the modification time */
+    http_file_info info;        /* response header info for the file */
+    char etag[ HTTP_ETAG_LENGTH ];  /* info.etag points here */
+    char* path;                 /* requested path */
+    char* data;                 /* if set, pre-rendered header + content */
+    size_t hdrsize;             /* size of the header in data */
+    size_t date;                /* offset of the Date value in data */
+}
+file_entry;
+
+/* longest path that is remembered as missing */
+#define MISS_PATH_MAX 128
+
+/*
+    A path that did not exist. To notice when it is created, the deepest
+    directory along the path that did exist is remembered with its
+    modification time, which changes if an entry in it is added.
+ */
+typedef struct
+{
+    unsigned long hash;         /* hash value of the key */
+    long expires;               /* monotonic time in seconds to check again */
+    int dirfd;                  /* directory the path is relative to */
+    int gzip;                   /* non-zero if the client accepted gzip */
+    size_t dirlen;              /* length of the existing directory part */
+    long dir_sec;               /* modification time of that directory */
+    long dir_nsec;
+    char path[ MISS_PATH_MAX ]; /* requested path, empty for a free slot */
+}
+miss_entry;
+
+/* direct mapped, a new miss replaces whatever was in its slot */
+static miss_entry* misses = NULL;
+static size_t num_misses = 0;
+
+static file_entry** buckets = NULL;
+static size_t num_buckets = 0;
+static size_t num_entries = 0;
+static size_t data_used = 0;
+static file_entry* lru_head = NULL;
+static file_entry* lru_tail = NULL;
+
+static long get_time_sec( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec;
+}
+
+static unsigned long hash_key( int dirfd, const char* path, int gzip )
+{
+    unsigned long hash = 2166136261UL;
+
+    while( *path )
+        hash = (hash ^ (unsigned char)*(path++)) * 16777619UL;
+
+    return hash ^ ((unsigned long)dirfd << 1) ^ (gzip ? 1 : 0);
+}
+
+static void lru_unlink( file_entry* e )
+{
+    if( e->prev ) e->prev->next = e->next;
+    else          lru_head = e->next;
+    if( e->next ) e->next->prev = e->prev;
+    else          lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push( file_entry* e )
+{
+    e->next = lru_head;
+    if( lru_head ) lru_head->prev = e;
+    else           lru_tail = e;
+    lru_head = e;
+}
+
+static void cache_remove( file_entry* e )
+{
+    file_entry** it = &buckets[ e->hash & (num_buckets - 1) ];
+
+    while( *it != e )
+        it = &(*it)->chain;
+
+    *it = e->chain;
+    lru_unlink( e );
+    close( e->fd );
+
+    if( e->data )
+    {
+        data_used -= e->hdrsize + e->info.size;
+        free( e->data );
+    }
+
+    free( e );
+    --num_entries;
+}
+
+/* check if the path still refers to the same, unmodified file */
+static int revalidate( const file_entry* e )
+{
+    struct stat sb;
+    size_t len;
+    char* ptr;
+
+    if( e->source == SRC_GZIP )
+    {
+        len = strlen( e->path );
+        ptr = alloca( len + 4 );
+        memcpy( ptr, e->path, len );
+        memcpy( ptr + len, ".gz", 4 );
+    }
+    else
+    {
+        ptr = e->path;
+    }
+
+    if( fstatat( e->dirfd, ptr, &sb, 0 ) != 0 )
+        return 0;
+
+    return sb.st_dev == e->dev && sb.st_ino == e->ino &&
+           (unsigned long)sb.st_size == e->size &&
+           sb.st_mtim.tv_sec == e->info.last_mod &&
+           sb.st_mtim.tv_nsec == e->mtime_ns;
+}
+
+static file_entry* cache_lookup( int dirfd, const char* path, int gzip )
+{
+    unsigned long hash;
+    file_entry* e;
+
+    if( !num_entries )
+        return NULL;
+
+    hash = hash_key( dirfd, path, gzip );
+
+    for( e = buckets[ hash & (num_buckets - 1) ]; e; e = e->chain )
+    {
+        if( e->hash == hash && e->dirfd == dirfd && e->gzip == gzip &&
+            !strcmp( e->path, path ) )
+        {
+            break;
+        }
+    }
+
+    /* a file waiting for a compressed copy is opened again to look for it */
+    if( e && e->expires <= get_time_sec( ) )
+    {
+        if( e->source != SRC_PENDING && revalidate( e ) )
+        {
+            e->expires = get_time_sec( ) + config_get_cache( )->ttl;
+        }
+        else
+        {
+            cache_remove( e );
+            e = NULL;
+        }
+    }
+
+    if( e && e != lru_head )
+    {
+        lru_unlink( e );
+        lru_push( e );
+    }
+    return e;
+}
+
+/* get the modification time of the first len bytes of path as directory */
+static int stat_dir( int dirfd, const char* path, size_t len,
+                     struct stat* sb )
+{
+    char* ptr;
+
+    if( !len )
+        return fstat( dirfd, sb ) == 0;
+
+    ptr = alloca( len + 1 );
+    memcpy( ptr, path, len );
+    ptr[ len ] = '\0';
+
+    return fstatat( dirfd, ptr, sb, 0 ) == 0 && S_ISDIR(sb->st_mode);
+}
+
+/* check if a path is known to be missing */
+static int miss_lookup( int dirfd, const char* path, int gzip )
+{
+    unsigned long hash;
+    struct stat sb;
+    miss_entry* m;
+
+    if( !num_misses )
+        return 0;
+
+    hash = hash_key( dirfd, path, gzip );
+    m = misses + (hash & (num_misses - 1));
+
+    if( m->hash != hash || m->dirfd != dirfd || m->gzip != gzip ||
+        strcmp( m->path, path ) )
+    {
+        return 0;
+    }
+
+    if( m->expires <= get_time_sec( ) )
+    {
+        if( !stat_dir( dirfd, m->path, m->dirlen, &sb ) ||
+            sb.st_mtim.tv_sec != m->dir_sec ||
+            sb.st_mtim.tv_nsec != m->dir_nsec )
+        {
+            m->path[0] = '\0';
+            return 0;
+        }
+
+        m->expires = get_time_sec( ) + config_get_cache( )->ttl;
+    }
+
+    return 1;
+}
+
+/* remember a path that does not exist */
+static void miss_insert( int dirfd, const char* path, int gzip )
+{
+    const cfg_cache* cfg = config_get_cache( );
+    size_t len = strlen( path );
+    struct stat sb;
+    miss_entry* m;
+
+    if( !cfg->misses || len >= MISS_PATH_MAX )
+        return;
+
+    if( !misses )
+    {
+        /* rounded down, the configured number is an upper bound */
+        for( num_misses = 1; num_misses * 2 <= (size_t)cfg->misses; )
+            num_misses <<= 1;
+
+        if( !(misses = calloc( num_misses, sizeof(misses[0]) )) )
+        {
+            num_misses = 0;
+            return;
+        }
+    }
+
+    /* find the deepest directory along the path that exists */
+    for( ;; )
+    {
+        while( len > 0 && path[len - 1] != '/' )
+            --len;
+        while( len > 0 && path[len - 1] == '/' )
+            --len;
+
+        if( stat_dir( dirfd, path, len, &sb ) )
+            break;
+        if( !len )
+            return;
+    }
+
+    m = misses + (hash_key( dirfd, path, gzip ) & (num_misses - 1));
+    m->hash = hash_key( dirfd, path, gzip );
+    m->expires = get_time_sec( ) + cfg->ttl;
+    m->dirfd = dirfd;
+    m->gzip = gzip;
+    m->dirlen = len;
+    m->dir_sec = sb.st_mtim.tv_sec;
+    m->dir_nsec = sb.st_mtim.tv_nsec;
+    strcpy( m->path, path );
+}
+
+/* take over an opened file, returns NULL if it cannot be cached */
+static file_entry* cache_insert( const file_entry* file )
+{
+    const cfg_cache* cfg = config_get_cache( );
+    size_t len = strlen( file->path );
+    file_entry* e;
+
+    if( !cfg->files )
+        return NULL;
+
+    if( !buckets )
+    {
+        for( num_buckets = 16; num_buckets < (size_t)cfg->files; )
+            num_buckets <<= 1;
+
+        if( !(buckets = calloc( num_buckets, sizeof(buckets[0]) )) )
+            return NULL;
+    }
+
+    if( num_entries >= (size_t)cfg->files )
+        cache_remove( lru_tail );
+
+    if( !(e = malloc( sizeof(*e) + len + 1 )) )
+        return NULL;
+
+    *e = *file;
+    e->data = NULL;
+    e->info.etag = e->etag;
+    e->path = (char*)(e + 1);
+    memcpy( e->path, file->path, len + 1 );
+
+    e->hash = hash_key( e->dirfd, e->path, e->gzip );
+    e->expires = get_time_sec( ) + cfg->ttl;
+    e->chain = buckets[ e->hash & (num_buckets - 1) ];
+    buckets[ e->hash & (num_buckets - 1) ] = e;
+    e->prev = e->next = NULL;
+    lru_push( e );
+    ++num_entries;
+    return e;
+}
+
+/* keep the complete response for a small file in memory */
+static void cache_load( file_entry* e )
+{
+    size_t budget = config_get_cache( )->memory;
+    size_t hdrsize, total;
+    ssize_t ret;
+    char* data;
+
+    if( e->info.size > (size_t)config_get_cache( )->max_size )
+        return;
+
+    /* if possible, share it with all other workers instead */
+    if( shcache_store( e->dirfd, e->gzip, e->path, config_get_cache( )->ttl,
+                       &e->info, e->fd ) )
+    {
+        return;
+    }
+
+    hdrsize = http_render_header( NULL, 0, &e->info, NULL );
+    total = hdrsize + e->info.size;
+
+    if( total > budget )
+        return;
+
+    while( data_used + total > budget && lru_tail != e )
+        cache_remove( lru_tail );
+
+    if( data_used + total > budget || !(data = malloc( total )) )
         return;
 
-    ++name;
-    count = sizeof(mimemap) / sizeof(mimemap[0]);
+    http_render_header( data, hdrsize, &e->info, &e->date );
+
+    ret = pread( e->fd, data + hdrsize, e->info.size, 0 );
+    if( ret < 0 || (size_t)ret != e->info.size )
+    {
+        free( data );
+        return;
+    }
+
+    e->data = data;
+    e->hdrsize = hdrsize;
+    data_used += total;
+}
+
+static int pipe_write( int* pfd, const void* data, size_t size )
+{
+    struct iovec iov;
+
+    iov.iov_base = (void*)data;
+    iov.iov_len = size;
+    return write_iov( pfd[1], &iov, 1 );
+}
+
+/* put a response header into the pipe, returns its size or zero */
+static size_t pipe_header( int* pfd, const http_file_info* info )
+{
+    char buffer[ HEADER_MAX ];
+    size_t len;
+
+    len = http_render_header( buffer, sizeof(buffer), info, NULL );
+    if( len > sizeof(buffer) || !pipe_write( pfd, buffer, len ) )
+        return 0;
+
+    return len;
+}
+
+/*
+    Answer a request for byte ranges of a file, taking the content from
+    memory if body is set, from filefd otherwise.
+
+    Returns a negative value if the whole file has to be sent instead,
+    otherwise zero or an ERR_* value like send_file.
+ */
+static int send_ranges( sock_t* sock, const http_request* req,
+                        const http_file_info* full, const char* body,
+                        int filefd )
+{
+    char parts[ HTTP_MAX_RANGES ][ PART_HEADER_MAX ];
+    size_t partlen[ HTTP_MAX_RANGES ], pipedata;
+    http_range ranges[ HTTP_MAX_RANGES ];
+    struct iovec iov[ HTTP_BODY_IOV ];
+    char value[ HTTP_RANGE_LENGTH ];
+    http_file_info info = *full;
+    int i, count, iovcount = 0;
+    unsigned long length;
+    int* pfd;
+
+    if( !(count = http_get_ranges( req, full, ranges, HTTP_MAX_RANGES )) )
+        return -1;
+
+    if( count < 0 )
+    {
+        http_format_range( value, NULL, full->size );
+        info.status = ERR_RANGE;
+        info.size = 0;
+        info.range = value;
+        http_response_header( sock, &info );
+        return 0;
+    }
+
+    info.status = ERR_PARTIAL;
+
+    if( count == 1 )
+    {
+        http_format_range( value, ranges, full->size );
+        info.range = value;
+        info.size = ranges[0].last - ranges[0].first + 1;
+    }
+    else
+    {
+        info.type = HTTP_MULTIPART_TYPE;
+        info.size = sizeof(HTTP_MULTIPART_END) - 1;
+
+        for( i=0; i<count; ++i )
+        {
+            partlen[i] = http_render_part( parts[i], PART_HEADER_MAX,
+                                           full->type, ranges + i,
+                                           full->size );
+            if( partlen[i] > PART_HEADER_MAX )
+                return -1;
+
+            info.size += partlen[i] + ranges[i].last - ranges[i].first + 1;
+        }
+    }
+
+    if( body )
+    {
+        for( i=0; i<count; ++i )
+        {
+            if( count > 1 )
+            {
+                iov[iovcount].iov_base = parts[i];
+                iov[iovcount++].iov_len = partlen[i];
+            }
+            iov[iovcount].iov_base = (void*)(body + ranges[i].first);
+            iov[iovcount++].iov_len = ranges[i].last - ranges[i].first + 1;
+        }
+
+        if( count > 1 )
+        {
+            iov[iovcount].iov_base = (void*)HTTP_MULTIPART_END;
+            iov[iovcount++].iov_len = sizeof(HTTP_MULTIPART_END) - 1;
+        }
+
+        http_send_response_iov( sock, &info, iov, iovcount );
+        return 0;
+    }
+
+    if( !(pfd = get_pipe( info.size + HEADER_RESERVE )) )
+        return ERR_INTERNAL;
+
+    if( !(pipedata = pipe_header( pfd, &info )) )
+    {
+        drop_pipe( );
+        return ERR_INTERNAL;
+    }
 
     for( i=0; i<count; ++i )
     {
-        if( !strcmp( name, mimemap[i].ending ) )
+        if( count > 1 )
         {
-            info->type = mimemap[i].mime;
-            info->flags = mimemap[i].flags;
+            if( !pipe_write( pfd, parts[i], partlen[i] ) )
+                goto fail;
+            pipedata += partlen[i];
         }
+
+        length = ranges[i].last - ranges[i].first + 1;
+
+        if( splice_to_sock( pfd, filefd, sock, ranges[i].first, length,
+                            pipedata ) )
+            goto fail;
+        pipedata = 0;
+    }
+
+    if( count > 1 )
+    {
+        pipedata = sizeof(HTTP_MULTIPART_END) - 1;
+        if( !pipe_write( pfd, HTTP_MULTIPART_END, pipedata ) )
+            goto fail;
+        if( splice_to_sock( pfd, filefd, sock, 0, 0, pipedata ) )
+            goto fail;
     }
+    return 0;
+fail:
+    drop_pipe( );
+    return 0;
 }
 
-static int send_file( int fd, const http_request* req, int filefd,
-                      int isgzip, struct stat* sb )
+static int send_file( sock_t* sock, const http_request* req,
+                      const file_entry* e )
 {
-    int pfd[2], hdrsize, ret = ERR_INTERNAL;
-    http_file_info info;
+    http_file_info info = e->info;
+    struct iovec iov;
+    int hdrsize, ret;
+    int* pfd;
 
-    memset( &info, 0, sizeof(info) );
-    guess_type( req->path, &info );
-    info.encoding = isgzip ? "gzip" : NULL;
-    info.size = sb->st_size;
-    info.last_mod = sb->st_mtim.tv_sec;
-
-    if( req->ifmod >= info.last_mod )
+    if( http_is_unchanged( req, &info ) )
     {
         info.status = ERR_UNCHANGED;
         goto outhdr;
     }
 
+    if( req->method!=HTTP_HEAD && req->method!=HTTP_GET )
+        return ERR_METHOD;
+
+    ret = send_ranges( sock, req, &info, e->data ? e->data + e->hdrsize : NULL,
+                       e->fd );
+    if( ret >= 0 )
+        return ret;
+
+    if( e->data )
+    {
+        memcpy( e->data + e->date, http_current_date( ), HTTP_DATE_LENGTH );
+        iov.iov_base = e->data;
+        iov.iov_len = e->hdrsize;
+        if( req->method==HTTP_GET )
+            iov.iov_len += info.size;
+        sock_send_iov( sock, &iov, 1 );
+        return 0;
+    }
+
     if( req->method==HTTP_HEAD ) goto outhdr;
-    if( req->method!=HTTP_GET  ) return ERR_METHOD;
-    if( pipe( pfd )!=0         ) return ERR_INTERNAL;
+    if( !(pfd = get_pipe( info.size + HEADER_RESERVE )) ) return ERR_INTERNAL;
 
-    if( (hdrsize = http_response_header( pfd[1], &info )) )
+    if( !(hdrsize = pipe_header( pfd, &info )) )
     {
-        splice_to_sock( pfd, filefd, fd, info.size, hdrsize );
-        ret = 0;
+        drop_pipe( );
+        return ERR_INTERNAL;
     }
 
-    close( pfd[0] );
-    close( pfd[1] );
-    return ret;
+    if( splice_to_sock( pfd, e->fd, sock, 0, info.size, hdrsize ) )
+        drop_pipe( );
+    return 0;
 outhdr:
-    http_response_header( fd, &info );
+    http_response_header( sock, &info );
+    return 0;
+}
+
+static int send_shared( sock_t* sock, const http_request* req,
+                        const shcache_entry* e )
+{
+    http_file_info info = *shcache_info( e );
+    int ret;
+
+    if( http_is_unchanged( req, &info ) )
+    {
+        info.status = ERR_UNCHANGED;
+        http_response_header( sock, &info );
+        return 0;
+    }
+
+    if( req->method!=HTTP_HEAD && req->method!=HTTP_GET )
+        return ERR_METHOD;
+
+    if( (ret = send_ranges( sock, req, &info, shcache_body( e ), -1 )) >= 0 )
+        return ret;
+
+    shcache_send( sock, e, req->method==HTTP_GET );
     return 0;
 }
 
@@ -112,31 +685,178 @@ static int try_open_gzip( int dirfd, const char* path )
     return openat( dirfd, ptr, O_RDONLY );
 }
 
-int http_send_file( int dirfd, int fd, const http_request* req )
+/* switch to a copy from the compression cache, or ask for one */
+static void use_packed( file_entry* e, const struct stat* orig )
 {
-    int filefd = -1, ret, isgzip = 0;
     struct stat sb;
+    int fd;
+
+    if( e->size < COMPCACHE_MIN_SIZE || e->size > COMPCACHE_MAX_SIZE )
+        return;
+
+    if( (fd = compcache_open( orig )) < 0 )
+    {
+        if( compcache_queue( e->dirfd, e->path ) )
+            e->source = SRC_PENDING;
+        return;
+    }
+
+    /* a copy that is not smaller is kept, so it is not requested again */
+    if( fstat( fd, &sb ) != 0 || (unsigned long)sb.st_size >= e->size )
+    {
+        close( fd );
+        return;
+    }
+
+    close( e->fd );
+    e->fd = fd;
+    e->source = SRC_PACKED;
+    e->info.encoding = "gzip";
+    e->info.size = sb.st_size;
+}
+
+static int open_file( file_entry* e )
+{
+    struct stat sb;
+    int variants;
+
+    e->fd = -1;
+
+    /* only look for a .gz file if the index does not rule it out */
+    variants = precomp_lookup( e->dirfd, e->path );
+
+    if( e->gzip && (variants < 0 || (variants & ENC_GZIP)) )
+    {
+        e->fd = try_open_gzip( e->dirfd, e->path );
+        if( e->fd >= 0 )
+            e->info.encoding = "gzip";
+    }
+
+    if( e->fd < 0 )
+        e->fd = openat( e->dirfd, e->path, O_RDONLY );
+
+    if( e->fd < 0 )
+        return ERR_NOT_FOUND;
+
+    if( fstat(e->fd, &sb)!=0 ) goto fail_internal;
+    if( !S_ISREG(sb.st_mode)  ) goto fail_forbidden;
+
+    mime_guess( e->path, &e->info );
+    e->info.flags |= FLAG_RANGES;
+    e->info.size = e->size = sb.st_size;
+    e->info.last_mod = sb.st_mtim.tv_sec;
+    e->mtime_ns = sb.st_mtim.tv_nsec;
+    e->dev = sb.st_dev;
+    e->ino = sb.st_ino;
+
+    if( e->info.encoding )
+        e->source = SRC_GZIP;
+    else if( e->gzip && mime_compressible( e->info.type ) )
+        use_packed( e, &sb );
+
+    /* other clients may get a different encoding of the same file */
+    if( variants < 0 || (variants & ENC_GZIP) ||
+        mime_compressible( e->info.type ) )
+    {
+        e->info.flags |= FLAG_VARY;
+    }
+
+    /* the encoded representation of a file needs a tag of its own */
+    sprintf( e->etag, "\"%lx-%lx-%lx.%lx%s\"", (unsigned long)e->ino,
+             e->size, (unsigned long)e->info.last_mod,
+             (unsigned long)e->mtime_ns, e->info.encoding ? "-gz" : "" );
+    e->info.etag = e->etag;
+    return 0;
+fail_internal:
+    close( e->fd );
+    return ERR_INTERNAL;
+fail_forbidden:
+    close( e->fd );
+    return ERR_FORBIDDEN;
+}
+
+int http_send_file( int dirfd, sock_t* sock, const http_request* req )
+{
+    int ret, gzip = (req->accept & ENC_GZIP) ? 1 : 0;
+    const shcache_entry* shared;
+    file_entry file, *e;
 
-    if( req->accept & ENC_GZIP )
+    if( (shared = shcache_acquire( dirfd, gzip, req->path )) )
     {
-        filefd = try_open_gzip( dirfd, req->path );
-        if( filefd >= 0 )
-            isgzip = 1;
+        ret = send_shared( sock, req, shared );
+        shcache_release( shared );
+        return ret;
     }
 
-    if( filefd < 0 )
-        filefd = openat( dirfd, req->path, O_RDONLY );
+    if( (e = cache_lookup( dirfd, req->path, gzip )) )
+    {
+        /* not in memory, e.g. after it expired in the shared cache */
+        if( !e->data )
+            cache_load( e );
+        return send_file( sock, req, e );
+    }
 
-    if( filefd < 0 )
+    if( miss_lookup( dirfd, req->path, gzip ) )
         return ERR_NOT_FOUND;
 
-    if( fstat(filefd, &sb)!=0 ) { ret = ERR_INTERNAL; goto out; }
-    if( !S_ISREG(sb.st_mode)  ) { ret = ERR_FORBIDDEN; goto out; }
+    memset( &file, 0, sizeof(file) );
+    file.dirfd = dirfd;
+    file.gzip = gzip;
+    file.path = (char*)req->path;
 
-    ret = send_file( fd, req, filefd, isgzip, &sb );
-out:
-    close( filefd );
+    if( (ret = open_file( &file )) != 0 )
+    {
+        if( ret == ERR_NOT_FOUND && (errno == ENOENT || errno == ENOTDIR) )
+            miss_insert( dirfd, req->path, gzip );
+        return ret;
+    }
+
+    if( (e = cache_insert( &file )) )
+    {
+        cache_load( e );
+        return send_file( sock, req, e );
+    }
+
+    ret = send_file( sock, req, &file );
+    close( file.fd );
     return ret;
 }
-#endif /* HAVE_STATIC */
 
+int http_file_cache_init( void )
+{
+    const cfg_cache* cfg = config_get_cache( );
+    cfg_host* h;
+
+    shcache_cleanup( );
+    precomp_cleanup( );
+
+    if( !mime_init( ) ||
+        !compcache_init( cfg->compress_dir, cfg->compress_max ) )
+        return 0;
+
+    /* directories that cannot be indexed fall back to trying each file */
+    for( h = config_get_hosts( ); h; h = h->next )
+    {
+        if( h->datadir >= 0 )
+            precomp_scan( h->datadir );
+    }
+
+    if( !cfg->shared )
+        return 1;
+
+    return shcache_init( cfg->shared, cfg->max_size );
+}
+
+void http_file_cache_cleanup( void )
+{
+    shcache_cleanup( );
+    precomp_cleanup( );
+    compcache_cleanup( );
+    mime_cleanup( );
+    drop_pipe( );
+
+    free( misses );
+    misses = NULL;
+    num_misses = 0;
+}
+#endif /* HAVE_STATIC */
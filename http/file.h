@@ -6,12 +6,26 @@
 /*
     Try to send a file
       dirfd: A file descriptor for a directory containing the file
-      fd: The socket to send the header + data to
+      sock: The socket to send the header + data to
       req: The HTTP request received from the client
 
     Returns 0 on success or an error code (ERR_*) on failure.
  */
-int http_send_file( int dirfd, int fd, const http_request* req );
+int http_send_file( int dirfd, sock_t* sock, const http_request* req );
+
+/*
+    Set up the static file cache that is shared by all workers, according
+    to the current configuration, compile the content type table and index
+    the precompressed files in the data directories of all hosts. Has to
+    be called before forking the workers and again after reloading the
+    configuration.
+
+    Returns non-zero on success, zero on failure.
+ */
+int http_file_cache_init( void );
+
+/* release the shared file cache, content types and precompressed index */
+void http_file_cache_cleanup( void );
 
 #endif /* FILE_H */
 
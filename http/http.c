@@ -1,67 +1,76 @@
 #include "http.h"
+#include "scan.h"
+#include "sock.h"
 #include "str.h"
 
 #include <unistd.h>
+#include <strings.h>
 #include <string.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <ctype.h>
-#include <stdio.h>
+#include <errno.h>
 #include <time.h>
+#include <zlib.h>
 
-static const char* header_fmt = "HTTP/1.1 %s\r\n"
-                                "Server: HTTP toaster\r\n"
-                                "X-Powered-By: Electricity\r\n"
-                                "Accept-Encoding: gzip, deflate\r\n"
-                                "Connection: keep-alive\r\n";
-
-static const char* http_date_fmt = "%a, %d %b %Y %H:%M:%S %Z";
-
-static const char* const status_msgs[] =
-{
-    "200 Ok",
-    "400 Bad Request",
-    "404 Not Found",
-    "405 Not Allowed",
-    "403 Forbidden",
-    "406 Not Acceptable",
-    "413 Payload Too Large",
-    "500 Internal Server Error",
-    "408 Request Time-out",
-    "307 Temporary Redirect",
-    "303 See Other",
-    "304 Not Modified",
-    "504 Gateway Timeout",
-};
+/* constant part of the response header for a given status line */
+#define HEADER_PREFIX( status ) "HTTP/1.1 " status "\r\n" \
+                                "Server: HTTP toaster\r\n" \
+                                "X-Powered-By: Electricity\r\n" \
+                                "Accept-Encoding: gzip, deflate\r\n" \
+                                "Connection: keep-alive\r\n"
 
-static const char* const status_text[] =
-{
-    NULL,
-    "The request sent by your browser contains an error.",
-    "The Web site you seek<br>cannot be located<br>but endless others exist.",
-    "The requested method is not allowed for this path",
-    "You are not authorized to access this path",
-    "The encoding of your request cannot be processed",
-    "The data sent to the server with your request is too large",
-    NULL,
-    "Your browser did not send a request in a timely manner.",
-    NULL,
-    NULL,
-    NULL,
-    "A timeout occoured while handling your request.",
-};
+#define STATUS( msg, text ) \
+    { HEADER_PREFIX( msg ), sizeof(HEADER_PREFIX( msg )) - 1, msg, text }
+
+static const char* http_date_fmt = "%a, %d %b %Y %H:%M:%S GMT";
+
+static const char days[] = "SunMonTueWedThuFriSat";
+static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
 
-static const struct { const char* field; int length; } hdrfields[] =
+/* indexed by ERR_* value, with pre-rendered header prefixes */
+static const struct
 {
-    { "Host: ",               6 },
-    { "Content-Length: ",    16 },
-    { "Content-Type: ",      14 },
-    { "Cookie: ",             8 },
-    { "If-Modified-Since: ", 19 },
-    { "Accept-Encoding: ",   17 },
-    { "Content-Encoding: ",  18 },
-    { "Connection: ",        12 },
+    const char* header;     /* pre-rendered start of the response header */
+    size_t length;          /* length of the header prefix */
+    const char* msg;        /* status line */
+    const char* text;       /* explanation shown on the default page */
+}
+status_info[] =
+{
+    STATUS( "200 Ok", NULL ),
+    STATUS( "400 Bad Request",
+            "The request sent by your browser contains an error." ),
+    STATUS( "404 Not Found",
+            "The Web site you seek<br>cannot be located<br>"
+            "but endless others exist." ),
+    STATUS( "405 Not Allowed",
+            "The requested method is not allowed for this path" ),
+    STATUS( "403 Forbidden",
+            "You are not authorized to access this path" ),
+    STATUS( "406 Not Acceptable",
+            "The encoding of your request cannot be processed" ),
+    STATUS( "413 Payload Too Large",
+            "The data sent to the server with your request is too large" ),
+    STATUS( "500 Internal Server Error", NULL ),
+    STATUS( "408 Request Time-out",
+            "Your browser did not send a request in a timely manner." ),
+    STATUS( "307 Temporary Redirect", NULL ),
+    STATUS( "303 See Other", NULL ),
+    STATUS( "304 Not Modified", NULL ),
+    STATUS( "504 Gateway Timeout",
+            "A timeout occoured while handling your request." ),
+    STATUS( "206 Partial Content", NULL ),
+    STATUS( "416 Range Not Satisfiable",
+            "The requested range of the resource cannot be served." ),
+    STATUS( "501 Not Implemented",
+            "The transfer coding of your request is not supported." ),
 };
 
+/* current time in HTTP date format, updated at most once per second */
+static time_t date_now = -1;
+static char date_now_str[ HTTP_DATE_LENGTH + 1 ];
+
 static const struct { const char* str; int length; } methods[] =
 {
     { "GET ",    4 },
@@ -71,11 +80,96 @@ static const struct { const char* str; int length; } methods[] =
     { "DELETE ", 7 },
 };
 
+static char* put_digits( char* ptr, unsigned int value, int count )
+{
+    while( count-- )
+    {
+        ptr[count] = '0' + value % 10;
+        value /= 10;
+    }
+    return ptr;
+}
+
+static char* put_ulong( char* ptr, unsigned long value )
+{
+    char temp[ 24 ];
+    size_t i = sizeof(temp);
+
+    do
+    {
+        temp[--i] = '0' + value % 10;
+        value /= 10;
+    }
+    while( value );
+
+    memcpy( ptr, temp + i, sizeof(temp) - i );
+    return ptr + sizeof(temp) - i;
+}
+
+static int add_iov( struct iovec* iov, int count, const void* data,
+                    size_t length )
+{
+    iov[count].iov_base = (void*)data;
+    iov[count].iov_len = length;
+    return count + 1;
+}
+
 static int hextoi( int c )
 {
     return isdigit(c) ? (c-'0') : (isupper(c) ? (c-'A'+10) : (c-'a'+10));
 }
 
+/*
+    Map a header field name to a FIELD_* value. Names are dispatched on
+    their length first, so at most a few candidates are compared.
+ */
+static int field_id( const char* name, size_t len )
+{
+#define FIELD( str, id ) \
+    if( tolower(name[0]) == str[0] && !strncasecmp( name, str, len ) ) \
+        return id
+
+    switch( len )
+    {
+    case 4:
+        FIELD( "host", FIELD_HOST );
+        break;
+    case 6:
+        FIELD( "cookie", FIELD_COOKIE );
+        break;
+    case 5:
+        FIELD( "range", FIELD_RANGE );
+        break;
+    case 8:
+        FIELD( "if-range", FIELD_IFRANGE );
+        break;
+    case 10:
+        FIELD( "connection", FIELD_CONNECTION );
+        break;
+    case 12:
+        FIELD( "content-type", FIELD_TYPE );
+        break;
+    case 13:
+        FIELD( "if-none-match", FIELD_IFNOMATCH );
+        break;
+    case 14:
+        FIELD( "content-length", FIELD_LENGTH );
+        break;
+    case 15:
+        FIELD( "accept-encoding", FIELD_ACCEPT );
+        break;
+    case 16:
+        FIELD( "content-encoding", FIELD_ENCODING );
+        break;
+    case 17:
+        FIELD( "if-modified-since", FIELD_IFMOD );
+        FIELD( "transfer-encoding", FIELD_TRANSFER );
+        break;
+    }
+#undef FIELD
+    return -1;
+}
+
 static int check_path( const char* path )
 {
     unsigned int len;
@@ -92,137 +186,248 @@ static int check_path( const char* path )
     return 1;
 }
 
-static char* store_string( http_request* rq, const char* string,
-                           size_t length )
-{
-    char* ptr;
+/****************************************************************************/
 
-    if( (rq->used + length + 1) > rq->size )
+const char* http_method_to_string( unsigned int method )
+{
+    if( method >= sizeof(methods)/sizeof(methods[0]) )
         return NULL;
 
-    ptr = rq->buffer + rq->used;
-    rq->used += length + 1;
+    return methods[method].str;
+}
 
-    memcpy( ptr, string, length );
-    ptr[length] = 0;
+void http_format_date( char* buffer, long timestamp )
+{
+    time_t t = timestamp;
+    struct tm stm;
 
-    return ptr;
+    gmtime_r( &t, &stm );
+
+    memcpy( buffer, days + 3 * stm.tm_wday, 3 );
+    buffer[3] = ',';
+    buffer[4] = ' ';
+    put_digits( buffer + 5, stm.tm_mday, 2 );
+    buffer[7] = ' ';
+    memcpy( buffer + 8, months + 3 * stm.tm_mon, 3 );
+    buffer[11] = ' ';
+    put_digits( buffer + 12, stm.tm_year + 1900, 4 );
+    buffer[16] = ' ';
+    put_digits( buffer + 17, stm.tm_hour, 2 );
+    buffer[19] = ':';
+    put_digits( buffer + 20, stm.tm_min, 2 );
+    buffer[22] = ':';
+    put_digits( buffer + 23, stm.tm_sec, 2 );
+    memcpy( buffer + 25, " GMT", 5 );
 }
 
-/****************************************************************************/
-
-const char* http_method_to_string( unsigned int method )
+const char* http_current_date( void )
 {
-    if( method >= sizeof(methods)/sizeof(methods[0]) )
-        return NULL;
+    time_t now = time( NULL );
 
-    return methods[method].str;
+    if( now != date_now )
+    {
+        http_format_date( date_now_str, now );
+        date_now = now;
+    }
+    return date_now_str;
 }
 
-size_t http_response_header( int fd, const http_file_info* info )
+/*
+    Collect the parts of a response header in an I/O vector, with the
+    fixed size fields rendered into a temporary buffer of HEADER_TEMP
+    bytes. The Date value is always at DATE_OFFSET in the second part.
+ */
+#define HEADER_TEMP 192
+#define HEADER_IOV 22
+#define DATE_OFFSET 6
+
+static int build_header( struct iovec* iov, char* temp,
+                         const http_file_info* info )
 {
-    const char* status;
     const char* cache;
-    char temp[ 256 ];
-    size_t len = 0;
+    char* ptr = temp;
     int statuscode;
-    struct tm stm;
-    string str;
-    time_t t;
+    int count = 0;
 
     statuscode = info->status;
 
     if( statuscode < 0 )
         statuscode = 0;
-    if( statuscode > (int)(sizeof(status_msgs)/sizeof(status_msgs[0])) )
+    if( statuscode >= (int)(sizeof(status_info)/sizeof(status_info[0])) )
         statuscode = 0;
 
-    status = status_msgs[ statuscode ];
+    count = add_iov( iov, count, status_info[ statuscode ].header,
+                     status_info[ statuscode ].length );
 
-    if( !string_init( &str ) )
-        return 0;
+    /* fields with fixed size values are rendered into the temp buffer */
+    memcpy( ptr, "Date: ", 6 );
+    memcpy( ptr + 6, http_current_date( ), HTTP_DATE_LENGTH );
+    memcpy( ptr + 6 + HTTP_DATE_LENGTH, "\r\nLast-Modified: ", 17 );
+    ptr += 6 + HTTP_DATE_LENGTH + 17;
 
-    len = sprintf( temp, header_fmt, status );
-    if( !string_append_len( &str, temp, len ) )
-        goto fail;
+    if( info->last_mod == date_now )
+        memcpy( ptr, date_now_str, HTTP_DATE_LENGTH );
+    else
+        http_format_date( ptr, info->last_mod );
 
-    if( info->redirect )
+    memcpy( ptr + HTTP_DATE_LENGTH, "\r\n", 2 );
+    ptr += HTTP_DATE_LENGTH + 2;
+
+    /* a 304 response must not claim the length of the omitted content */
+    if( info->flags & FLAG_CHUNKED )
+    {
+        memcpy( ptr, "Transfer-Encoding: chunked\r\n", 28 );
+        ptr += 28;
+    }
+    else if( info->size || statuscode != ERR_UNCHANGED )
     {
-        if( !string_append( &str, "Location: "   ) ) goto fail;
-        if( !string_append( &str, info->redirect ) ) goto fail;
-        if( !string_append( &str, "\r\n"         ) ) goto fail;
+        memcpy( ptr, "Content-Length: ", 16 );
+        ptr = put_ulong( ptr + 16, info->size );
+        *(ptr++) = '\r';
+        *(ptr++) = '\n';
     }
 
-    if( info->type )
+    if( info->flags & FLAG_RANGES )
     {
-        len = sprintf(temp, "Content-Type: %s\r\n", info->type);
-        if( !string_append_len( &str, temp, len ) )
-            goto fail;
+        memcpy( ptr, "Accept-Ranges: bytes\r\n", 22 );
+        ptr += 22;
     }
 
-    if( info->size )
+    if( info->flags & FLAG_VARY )
     {
-        len = sprintf(temp, "Content-Length: %lu\r\n",
-                      (unsigned long)info->size);
-        if( !string_append_len( &str, temp, len ) )
-            goto fail;
+        memcpy( ptr, "Vary: Accept-Encoding\r\n", 23 );
+        ptr += 23;
     }
 
-    if( info->encoding )
+    count = add_iov( iov, count, temp, ptr - temp );
+
+    if( info->etag )
     {
-        len = sprintf(temp, "Content-Encoding: %s\r\n", info->encoding);
-        if( !string_append_len( &str, temp, len ) )
-            goto fail;
+        count = add_iov( iov, count, "ETag: ", 6 );
+        count = add_iov( iov, count, info->etag, strlen(info->etag) );
+        count = add_iov( iov, count, "\r\n", 2 );
     }
 
-    if( info->setcookies )
+    if( info->range )
     {
-        if( !string_append( &str, "Set-Cookie: "   ) ) goto fail;
-        if( !string_append( &str, info->setcookies ) ) goto fail;
-        if( !string_append( &str, "\r\n"           ) ) goto fail;
+        count = add_iov( iov, count, "Content-Range: ", 15 );
+        count = add_iov( iov, count, info->range, strlen(info->range) );
+        count = add_iov( iov, count, "\r\n", 2 );
     }
 
-    t = info->last_mod;
-    localtime_r( &t, &stm );
-    len = strftime( temp, sizeof(temp), http_date_fmt, &stm );
+    if( info->redirect )
+    {
+        count = add_iov( iov, count, "Location: ", 10 );
+        count = add_iov( iov, count, info->redirect, strlen(info->redirect) );
+        count = add_iov( iov, count, "\r\n", 2 );
+    }
 
-    if( !string_append( &str, "Last-Modified: " ) ) goto fail;
-    if( !string_append_len( &str, temp, len     ) ) goto fail;
-    if( !string_append( &str, "\r\n"            ) ) goto fail;
+    if( info->type )
+    {
+        count = add_iov( iov, count, "Content-Type: ", 14 );
+        count = add_iov( iov, count, info->type, strlen(info->type) );
+        count = add_iov( iov, count, "\r\n", 2 );
+    }
+
+    if( info->encoding )
+    {
+        count = add_iov( iov, count, "Content-Encoding: ", 18 );
+        count = add_iov( iov, count, info->encoding, strlen(info->encoding) );
+        count = add_iov( iov, count, "\r\n", 2 );
+    }
+
+    if( info->setcookies )
+    {
+        count = add_iov( iov, count, "Set-Cookie: ", 12 );
+        count = add_iov( iov, count, info->setcookies,
+                         strlen(info->setcookies) );
+        count = add_iov( iov, count, "\r\n", 2 );
+    }
 
     if( info->flags & FLAG_STATIC_RESOURCE )
-        cache = "Cache-Control: max-age=604800\r\n";
+        cache = "Cache-Control: max-age=604800\r\n\r\n";
     else if( info->flags & FLAG_STATIC )
-        cache = "Cache-Control: max-age=86400\r\n";
+        cache = "Cache-Control: max-age=86400\r\n\r\n";
     else if( info->flags & FLAG_DYNAMIC )
-        cache = "Cache-Control: no-store, must-revalidate\r\n";
+        cache = "Cache-Control: no-store, must-revalidate\r\n\r\n";
     else
-        cache = NULL;
+        cache = "\r\n";
 
-    if( cache && !string_append( &str, cache ) )
-        goto fail;
-    if( !string_append( &str, "\r\n" ) )
-        goto fail;
+    return add_iov( iov, count, cache, strlen(cache) );
+}
 
-    len = str.used;
-    write( fd, str.data, str.used );
-    string_cleanup( &str );
+size_t http_send_response( sock_t* sock, const http_file_info* info,
+                           const void* body, size_t size )
+{
+    struct iovec iov;
+
+    iov.iov_base = (void*)body;
+    iov.iov_len = size;
+
+    return http_send_response_iov( sock, info, &iov, size ? 1 : 0 );
+}
+
+size_t http_send_response_iov( sock_t* sock, const http_file_info* info,
+                               const struct iovec* body, int count )
+{
+    struct iovec iov[ HEADER_IOV + HTTP_BODY_IOV ];
+    char temp[ HEADER_TEMP ];
+    size_t len = 0;
+    int i, total;
+
+    if( count > HTTP_BODY_IOV )
+        return 0;
+
+    total = build_header( iov, temp, info );
+
+    for( i = 0; i < count; ++i )
+        iov[ total++ ] = body[i];
+
+    for( i = 0; i < total; ++i )
+        len += iov[i].iov_len;
+
+    return sock_send_iov( sock, iov, total ) ? len : 0;
+}
+
+size_t http_render_header( char* buffer, size_t size,
+                           const http_file_info* info, size_t* date )
+{
+    struct iovec iov[ HEADER_IOV ];
+    char temp[ HEADER_TEMP ];
+    size_t len = 0;
+    int i, count;
+
+    count = build_header( iov, temp, info );
+
+    for( i = 0; i < count; ++i )
+        len += iov[i].iov_len;
+
+    if( len > size )
+        return len;
+
+    for( i = 0; i < count; ++i )
+    {
+        memcpy( buffer, iov[i].iov_base, iov[i].iov_len );
+        buffer += iov[i].iov_len;
+    }
+
+    if( date )
+        *date = iov[0].iov_len + DATE_OFFSET;
     return len;
-fail:
-    string_cleanup( &str );
-    return 0;
 }
 
-int http_request_init( http_request* rq, const char* request,
-                       char* stringbuffer, size_t size )
+size_t http_response_header( sock_t* sock, const http_file_info* info )
+{
+    return http_send_response( sock, info, NULL, 0 );
+}
+
+int http_request_init( http_request* rq, char* request )
 {
-    char* str;
+    char* version;
     size_t i;
 
     memset( rq, 0, sizeof(*rq) );
     rq->method = -1;
-    rq->buffer = stringbuffer;
-    rq->size = size;
 
     for( i=0; i<sizeof(methods)/sizeof(methods[0]); ++i )
     {
@@ -242,27 +447,26 @@ int http_request_init( http_request* rq, const char* request,
 
     for( i=0; request[i] && !isspace(request[i]); ++i ) { }
 
+    for( version=request+i; isspace(*version); ++version ) { }
+
+    if( !strncmp(version, "HTTP/", 5) || !strncmp(version, "http/", 5) )
+    {
+        version += 5;
+        if( *version=='0' || !strncmp(version, "1.0", 3) )
+            rq->flags |= REQ_CLOSE | REQ_HTTP10;
+    }
+
     if( i )
     {
-        rq->path = str = store_string( rq, request, i );
-        if( !rq->path )
-            return 0;
+        request[i] = '\0';
+        rq->path = request;
 
-        rq->numargs = http_split_args( str );
+        rq->numargs = http_split_args( request );
         if( (rq->numargs < 1) || !check_path( rq->path ) )
             return 0;
 
         if( rq->numargs-- > 1 )
-            rq->getargs = str + strlen(str) + 1;
-    }
-
-    for( request+=i; isspace(*request); ++request ) { }
-
-    if( !strncmp(request, "HTTP/", 5) || !strncmp(request, "http/", 5) )
-    {
-        request += 5;
-        if( *request=='0' || !strncmp(request, "1.0", 3) )
-            rq->flags |= REQ_CLOSE;
+            rq->getargs = request + strlen(request) + 1;
     }
 
     return 1;
@@ -270,51 +474,54 @@ int http_request_init( http_request* rq, const char* request,
 
 int http_parse_attribute( http_request* rq, char* line )
 {
+    char *ptr, *value;
     struct tm stm;
-    char *ptr;
-    size_t i;
+    size_t len;
 
-    for( i=0; i<sizeof(hdrfields)/sizeof(hdrfields[0]); ++i )
-    {
-        if( !strncmp( line, hdrfields[i].field, hdrfields[i].length ) )
-        {
-            line += hdrfields[i].length;
-            while( isspace(*line) )
-                ++line;
-            break;
-        }
-    }
+    if( !(value = strchr( line, ':' )) )
+        return 1;
+
+    for( len = value - line; len && line[len - 1] == ' '; --len ) { }
 
-    switch( i )
+    for( ++value; isspace(*value); ++value ) { }
+
+    switch( field_id( line, len ) )
     {
     case FIELD_HOST:
-        ptr = strchrnul( line, ':' );
-        rq->host = store_string( rq, line, ptr-line );
-        if( !rq->host )
-            return 0;
+        ptr = strchrnul( value, ':' );
+        *ptr = '\0';
+        rq->host = value;
         break;
     case FIELD_LENGTH:
-        rq->length = strtol( line, NULL, 10 );
+        /* a second length could be read differently by a proxy */
+        if( !isdigit( *value ) || (rq->flags & REQ_LENGTH) )
+            return 0;
+
+        errno = 0;
+        rq->length = strtoul( value, &ptr, 10 );
+        while( *ptr == ' ' )
+            ++ptr;
+
+        if( *ptr || errno == ERANGE )
+            return 0;
+
+        rq->flags |= REQ_LENGTH;
         break;
     case FIELD_TYPE:
-        rq->type = store_string( rq, line, strlen(line) );
-        if( !rq->type )
-            return 0;
+        rq->type = value;
         break;
     case FIELD_COOKIE:
-        rq->cookies = ptr = store_string( rq, line, strlen(line) );
-        if( !ptr )
-            return 0;
+        rq->cookies = ptr = value;
         while( strsep(&ptr, "; ") )
             ++rq->numcookies;
         break;
     case FIELD_IFMOD:
         memset( &stm, 0, sizeof(stm) );
-        strptime(line, http_date_fmt, &stm);
-        rq->ifmod = mktime(&stm);
+        strptime(value, http_date_fmt, &stm);
+        rq->ifmod = timegm(&stm);
         break;
     case FIELD_ACCEPT:
-        while( (ptr = strsep(&line, ", ")) )
+        while( (ptr = strsep(&value, ", ")) )
         {
             if( !strcmp( ptr, "gzip" ) )
                 rq->accept |= ENC_GZIP;
@@ -323,55 +530,390 @@ int http_parse_attribute( http_request* rq, char* line )
         }
         break;
     case FIELD_ENCODING:
-        if( !strcmp( line, "gzip"    ) ) { rq->encoding=ENC_GZIP;    break; }
-        if( !strcmp( line, "deflate" ) ) { rq->encoding=ENC_DEFLATE; break; }
+        if( !strcmp( value, "gzip"    ) ) { rq->encoding=ENC_GZIP;    break; }
+        if( !strcmp( value, "deflate" ) ) { rq->encoding=ENC_DEFLATE; break; }
+        if( !strcmp( value, "identity" ) ) break;
         return 0;
     case FIELD_CONNECTION:
-        if( !strcmp( line, "Close" ) || !strcmp( line, "close" ) )
+        if( !strcasecmp( value, "close" ) )
             rq->flags |= REQ_CLOSE;
         else
             rq->flags &= ~REQ_CLOSE;
         break;
+    case FIELD_RANGE:
+        rq->range = value;
+        break;
+    case FIELD_IFRANGE:
+        rq->ifrange = value;
+        break;
+    case FIELD_IFNOMATCH:
+        rq->ifnomatch = value;
+        break;
+    case FIELD_TRANSFER:
+        if( strcasecmp( value, "chunked" ) )
+        {
+            rq->flags |= REQ_CODING;
+            return 0;
+        }
+        rq->flags |= REQ_CHUNKED;
+        break;
     }
     return 1;
 }
 
+/* check if an entity tag is in a comma separated list (weak comparison) */
+static int etag_in_list( const char* list, const char* etag )
+{
+    size_t len = strlen( etag ), n;
+
+    while( *list )
+    {
+        while( *list == ' ' || *list == ',' )
+            ++list;
+
+        n = strcspn( list, ", " );
+        if( n == 1 && *list == '*' )
+            return 1;
+        if( n > 2 && list[0] == 'W' && list[1] == '/' )
+            list += 2, n -= 2;
+        if( n == len && !strncmp( list, etag, len ) )
+            return 1;
+
+        list += n;
+    }
+    return 0;
+}
+
+int http_is_unchanged( const http_request* rq, const http_file_info* info )
+{
+    if( rq->ifnomatch )
+        return info->etag && etag_in_list( rq->ifnomatch, info->etag );
+
+    return rq->ifmod >= info->last_mod;
+}
+
+int http_get_ranges( const http_request* rq, const http_file_info* info,
+                     http_range* ranges, int max )
+{
+    unsigned long first, last, size = info->size;
+    const char* ptr = rq->range;
+    int count = 0, specs = 0;
+    int satisfiable;
+    struct tm stm;
+    char* end;
+
+    if( !ptr || rq->method != HTTP_GET )
+        return 0;
+
+    /* a validator that does not match means the client wants it all */
+    if( rq->ifrange && rq->ifrange[0] == '"' )
+    {
+        if( !info->etag || strcmp( rq->ifrange, info->etag ) )
+            return 0;
+    }
+    else if( rq->ifrange )
+    {
+        memset( &stm, 0, sizeof(stm) );
+        if( !strptime( rq->ifrange, http_date_fmt, &stm ) ||
+            timegm( &stm ) != info->last_mod )
+            return 0;
+    }
+
+    if( strncasecmp( ptr, "bytes=", 6 ) )
+        return 0;
+
+    for( ptr += 6; ; ptr = end )
+    {
+        while( *ptr == ' ' || *ptr == ',' )
+            ++ptr;
+        if( !*ptr )
+            break;
+
+        if( *ptr == '-' )
+        {
+            /* suffix range, i.e. the last n bytes */
+            if( !isdigit( ptr[1] ) )
+                return 0;
+            last = strtoul( ptr + 1, &end, 10 );
+            satisfiable = last && size;
+            first = last < size ? size - last : 0;
+            last = size - 1;
+        }
+        else
+        {
+            if( !isdigit( *ptr ) )
+                return 0;
+            first = strtoul( ptr, &end, 10 );
+            if( *(end++) != '-' )
+                return 0;
+            last = isdigit( *end ) ? strtoul( end, &end, 10 ) : ULONG_MAX;
+            if( last < first )
+                return 0;
+            satisfiable = first < size;
+            if( last >= size )
+                last = size - 1;
+        }
+
+        while( *end == ' ' )
+            ++end;
+        if( *end && *end != ',' )
+            return 0;
+
+        ++specs;
+        if( !satisfiable )
+            continue;
+        if( count == max )
+            return 0;
+
+        ranges[ count ].first = first;
+        ranges[ count ].last = last;
+        ++count;
+    }
+
+    if( !specs )
+        return 0;
+
+    return count ? count : -1;
+}
+
+void http_format_range( char* buffer, const http_range* range,
+                        unsigned long size )
+{
+    char* ptr = buffer;
+
+    memcpy( ptr, "bytes ", 6 );
+    ptr += 6;
+
+    if( range )
+    {
+        ptr = put_ulong( ptr, range->first );
+        *(ptr++) = '-';
+        ptr = put_ulong( ptr, range->last );
+    }
+    else
+    {
+        *(ptr++) = '*';
+    }
+
+    *(ptr++) = '/';
+    ptr = put_ulong( ptr, size );
+    *ptr = '\0';
+}
+
+#define PART_START "\r\n--" HTTP_BOUNDARY "\r\nContent-Type: "
+
+size_t http_render_part( char* buffer, size_t size, const char* type,
+                         const http_range* range, unsigned long total )
+{
+    size_t typelen = strlen( type ), valuelen, len;
+    char value[ HTTP_RANGE_LENGTH ];
+
+    http_format_range( value, range, total );
+    valuelen = strlen( value );
+    len = sizeof(PART_START) - 1 + typelen + 17 + valuelen + 4;
+
+    if( len > size )
+        return len;
+
+    memcpy( buffer, PART_START, sizeof(PART_START) - 1 );
+    buffer += sizeof(PART_START) - 1;
+    memcpy( buffer, type, typelen );
+    buffer += typelen;
+    memcpy( buffer, "\r\nContent-Range: ", 17 );
+    buffer += 17;
+    memcpy( buffer, value, valuelen );
+    memcpy( buffer + valuelen, "\r\n\r\n", 4 );
+    return len;
+}
+
+void http_parser_init( http_parser* p, http_request* rq )
+{
+    p->rq = rq;
+    p->scanned = 0;
+    p->status = ERR_BAD_REQ;
+}
+
+/* normalize a line in place, see http_parser_feed */
+static void normalize_line( char* line, size_t length )
+{
+    char *in = line, *end = line + length, *out = line;
+    char c, orig;
+    size_t n;
+
+    while( in < end )
+    {
+        c = orig = *(in++);
+        if( c == '\t' ) c = ' ';
+        if( c == '\\' ) c = '/';
+        if( isspace(c) && c != ' ' )
+            continue;
+        if( c == '/' && out > line && out[-1] == '/' )
+            continue;
+        if( c == ' ' && (out == line || out[-1] == ' ') )
+            continue;
+        *(out++) = c;
+
+        /* after a byte that was kept as is, skip ahead to the next one
+           that needs rewriting */
+        if( c == orig )
+        {
+            n = http_scan_plain( in, end - in );
+            if( out != in )
+                memmove( out, in, n );
+            in += n;
+            out += n;
+        }
+    }
+
+    while( out > line && out[-1] == ' ' )
+        --out;
+
+    *out = '\0';
+}
+
+int http_parser_feed( http_parser* p, char* data, size_t size,
+                      size_t* consumed )
+{
+    char *line, *end, *next;
+
+    *consumed = 0;
+
+    /* skip empty lines in front of a request, e.g. after a body */
+    if( !p->scanned )
+    {
+        while( *consumed < size && (data[*consumed] == '\r' ||
+                                    data[*consumed] == '\n') )
+        {
+            ++(*consumed);
+        }
+        data += *consumed;
+        size -= *consumed;
+    }
+
+    for( line = data + p->scanned; ; line = end + 1 )
+    {
+        if( !(end = memchr( line, '\n', data + size - line )) )
+        {
+            p->scanned = line - data;
+            return 0;
+        }
+        if( end == line || (end == line + 1 && *line == '\r') )
+            break;
+    }
+
+    *consumed += end + 1 - data;
+    end = line;
+
+    for( line = data; line < end; line = next )
+    {
+        next = (char*)memchr( line, '\n', end - line ) + 1;
+        normalize_line( line, next - 1 - line );
+
+        if( line == data )
+        {
+            if( !http_request_init( p->rq, line ) )
+                return -1;
+        }
+        else if( line[0] && !http_parse_attribute( p->rq, line ) )
+        {
+            p->status = (p->rq->flags & REQ_CODING) ? ERR_NOT_IMPL :
+                                                      ERR_BAD_REQ;
+            return -1;
+        }
+    }
+
+    if( (p->rq->flags & REQ_CHUNKED) && (p->rq->flags & REQ_LENGTH) )
+        return -1;
+
+    return 1;
+}
+
+/* text of a redirect page around the location */
+#define REDIRECT_START "Your browser is being redirected to a different " \
+                       "location.<br><br>If it does not work, click " \
+                       "<a href=\""
+#define REDIRECT_END "\">here</a></body></html>"
+
+#define NUM_STATUS (sizeof(status_info) / sizeof(status_info[0]))
+
+/* encodings a default page is rendered in */
+#define PAGE_IDENTITY 0
+#define PAGE_DEFLATE 1
+#define PAGE_GZIP 2
+#define PAGE_ENCODINGS 3
+
+/* a complete response with a default page, only the Date is patched */
+typedef struct
+{
+    char* data;         /* response header followed by the page */
+    size_t size;        /* total size of the response */
+    size_t date;        /* offset of the Date value in data */
+}
+default_page;
+
+/*
+    A constant piece of a redirect page. The compressed form is a raw
+    deflate stream that ends on a byte boundary, so the pieces can be
+    joined with a stored block holding the location in between.
+ */
+typedef struct
+{
+    char* text;             /* uncompressed text */
+    size_t length;          /* length of the text */
+    unsigned char* packed;  /* raw deflate compressed text */
+    size_t packed_size;     /* size of the compressed text */
+    unsigned long crc;      /* CRC-32 of the text, for gzip */
+    unsigned long adler;    /* Adler-32 of the text, for zlib */
+}
+page_piece;
+
+static default_page pages[ NUM_STATUS ][ PAGE_ENCODINGS ];
+
+/* start of the ERR_REDIRECT and ERR_REDIRECT_GET pages, and their end */
+static page_piece redirect_start[ 2 ];
+static page_piece redirect_end;
+
+static int append_page_start( string* str, const char* headline )
+{
+    int ret;
+
+    ret = string_append( str, "<!DOCTYPE html><html><head><title>" );
+    ret = ret && string_append( str, headline );
+    ret = ret && string_append( str, "</title></head><body><h1>" );
+    ret = ret && string_append( str, headline );
+    ret = ret && string_append( str, "</h1>" );
+    return ret;
+}
+
 int gen_default_page( string* str, http_file_info* info,
                       int status, int accept, const char* redirect )
 {
-    const char *text, *headline;
+    const char* text;
     int ret = 1;
 
     if( status < 0 )
         status = ERR_INTERNAL;
-    if( status > (int)(sizeof(status_text)/sizeof(status_text[0])) )
+    if( status >= (int)NUM_STATUS )
         status = ERR_INTERNAL;
 
-    headline = status_msgs[ status ];
-    text = status_text[ status ];
+    text = status_info[ status ].text;
 
     ret = string_init( str );
-    ret = ret && string_append( str, "<!DOCTYPE html><html><head><title>" );
-    ret = ret && string_append( str, headline );
-    ret = ret && string_append( str, "</title></head><body><h1>" );
-    ret = ret && string_append( str, headline );
-    ret = ret && string_append( str, "</h1>" );
+    ret = ret && append_page_start( str, status_info[ status ].msg );
 
     if( redirect )
     {
-        ret = ret && string_append( str, "Your browser is being redirected "
-                                         "to a different location.<br><br>"
-                                         "If it does not work, click "
-                                         "<a href=\"" );
+        ret = ret && string_append( str, REDIRECT_START );
         ret = ret && string_append( str, redirect );
-        ret = ret && string_append( str, "\">here</a>" );
+        ret = ret && string_append( str, REDIRECT_END );
     }
-    else if( text && ret )
+    else
     {
-        ret = string_append( str, text );
-    }
+        if( text && ret )
+            ret = string_append( str, text );
 
-    ret = ret && string_append( str, "</body></html>" );
+        ret = ret && string_append( str, "</body></html>" );
+    }
 
     memset( info, 0, sizeof(*info) );
     if( !ret )
@@ -383,6 +925,7 @@ int gen_default_page( string* str, http_file_info* info,
         info->encoding = string_compress(str, 1) ? "gzip" : NULL;
 
     info->status = status;
+    info->flags = FLAG_VARY;
     info->type = "text/html; charset=utf-8";
     info->last_mod = time(0);
     info->size = str->used;
@@ -393,6 +936,281 @@ fail:
     return 0;
 }
 
+static int render_page( default_page* page, int status, int accept )
+{
+    http_file_info info;
+    size_t hdrsize;
+    string str;
+
+    if( !gen_default_page( &str, &info, status, accept, NULL ) )
+        return 0;
+
+    hdrsize = http_render_header( NULL, 0, &info, NULL );
+
+    if( !(page->data = malloc( hdrsize + str.used )) )
+    {
+        string_cleanup( &str );
+        return 0;
+    }
+
+    http_render_header( page->data, hdrsize, &info, &page->date );
+    memcpy( page->data + hdrsize, str.data, str.used );
+    page->size = hdrsize + str.used;
+    string_cleanup( &str );
+    return 1;
+}
+
+static int pack_piece( page_piece* p, const char* text, int flush )
+{
+    z_stream strm;
+    size_t bound;
+    int ret;
+
+    memset( &strm, 0, sizeof(strm) );
+
+    p->length = strlen( text );
+    p->crc = crc32( 0, (const Bytef*)text, p->length );
+    p->adler = adler32( 1, (const Bytef*)text, p->length );
+
+    if( !(p->text = malloc( p->length + 1 )) )
+        return 0;
+
+    memcpy( p->text, text, p->length + 1 );
+
+    if( deflateInit2( &strm, Z_BEST_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+                      MAX_MEM_LEVEL, Z_DEFAULT_STRATEGY ) != Z_OK )
+    {
+        return 0;
+    }
+
+    /* a sync flush adds an empty stored block */
+    bound = deflateBound( &strm, p->length ) + 16;
+
+    if( !(p->packed = malloc( bound )) )
+        goto fail;
+
+    strm.next_in = (Bytef*)p->text;
+    strm.avail_in = p->length;
+    strm.next_out = p->packed;
+    strm.avail_out = bound;
+
+    ret = deflate( &strm, flush );
+    if( strm.avail_in || ret != (flush == Z_FINISH ? Z_STREAM_END : Z_OK) )
+        goto fail;
+
+    p->packed_size = bound - strm.avail_out;
+    deflateEnd( &strm );
+    return 1;
+fail:
+    deflateEnd( &strm );
+    return 0;
+}
+
+static void free_piece( page_piece* p )
+{
+    free( p->text );
+    free( p->packed );
+    memset( p, 0, sizeof(*p) );
+}
+
+int http_default_pages_init( void )
+{
+    static const int accept[ PAGE_ENCODINGS ] = { 0, ENC_DEFLATE, ENC_GZIP };
+    size_t i, j;
+    string str;
+    int ret;
+
+    http_default_pages_cleanup( );
+
+    for( i = 0; i < NUM_STATUS; ++i )
+    {
+        for( j = 0; j < PAGE_ENCODINGS; ++j )
+        {
+            if( !render_page( &pages[i][j], i, accept[j] ) )
+                goto fail;
+        }
+    }
+
+    for( i = 0; i < 2; ++i )
+    {
+        ret = string_init( &str );
+        ret = ret && append_page_start( &str,
+                                        status_info[ ERR_REDIRECT + i ].msg );
+        ret = ret && string_append( &str, REDIRECT_START );
+        ret = ret && pack_piece( &redirect_start[i], str.data, Z_SYNC_FLUSH );
+        string_cleanup( &str );
+
+        if( !ret )
+            goto fail;
+    }
+
+    if( !pack_piece( &redirect_end, REDIRECT_END, Z_FINISH ) )
+        goto fail;
+
+    return 1;
+fail:
+    http_default_pages_cleanup( );
+    return 0;
+}
+
+void http_default_pages_cleanup( void )
+{
+    size_t i, j;
+
+    for( i = 0; i < NUM_STATUS; ++i )
+    {
+        for( j = 0; j < PAGE_ENCODINGS; ++j )
+        {
+            free( pages[i][j].data );
+            pages[i][j].data = NULL;
+        }
+    }
+
+    free_piece( &redirect_start[0] );
+    free_piece( &redirect_start[1] );
+    free_piece( &redirect_end );
+}
+
+static int send_generated_page( sock_t* sock, int status, int accept,
+                                const char* redirect )
+{
+    http_file_info info;
+    string page;
+    size_t ret;
+
+    if( !gen_default_page( &page, &info, status, accept, redirect ) )
+        return 0;
+
+    ret = http_send_response( sock, &info, page.data, page.used );
+    string_cleanup( &page );
+    return ret != 0;
+}
+
+int http_send_default_page( sock_t* sock, int status, int accept )
+{
+    default_page* page;
+    struct iovec iov;
+
+    if( status < 0 || status >= (int)NUM_STATUS )
+        status = ERR_INTERNAL;
+
+    if( accept & ENC_DEFLATE )
+        page = &pages[ status ][ PAGE_DEFLATE ];
+    else if( accept & ENC_GZIP )
+        page = &pages[ status ][ PAGE_GZIP ];
+    else
+        page = &pages[ status ][ PAGE_IDENTITY ];
+
+    if( !page->data )
+        return send_generated_page( sock, status, accept, NULL );
+
+    memcpy( page->data + page->date, http_current_date( ),
+            HTTP_DATE_LENGTH );
+
+    iov.iov_base = page->data;
+    iov.iov_len = page->size;
+    return sock_send_iov( sock, &iov, 1 );
+}
+
+static void put_le32( unsigned char* ptr, unsigned long value )
+{
+    ptr[0] = value & 0xFF;
+    ptr[1] = (value >> 8) & 0xFF;
+    ptr[2] = (value >> 16) & 0xFF;
+    ptr[3] = (value >> 24) & 0xFF;
+}
+
+int http_send_redirect( sock_t* sock, int status, int accept,
+                        const char* location )
+{
+    static const unsigned char gzip_header[10] = { 0x1F, 0x8B, 8, 0, 0, 0,
+                                                   0, 0, 2, 3 };
+    static const unsigned char zlib_header[2] = { 0x78, 0xDA };
+    unsigned char stored[5], trailer[8];
+    const page_piece* start;
+    unsigned long check;
+    struct iovec iov[6];
+    http_file_info info;
+    size_t i, len;
+    int count = 0;
+
+    len = strlen( location );
+
+    /* the location has to fit into a single stored block */
+    if( (status != ERR_REDIRECT && status != ERR_REDIRECT_GET) ||
+        !redirect_end.packed || len > 0xFFFF )
+    {
+        return send_generated_page( sock, status, accept, location );
+    }
+
+    start = &redirect_start[ status - ERR_REDIRECT ];
+
+    memset( &info, 0, sizeof(info) );
+    info.status = status;
+    info.flags = FLAG_VARY;
+    info.type = "text/html; charset=utf-8";
+    info.last_mod = time(0);
+    info.redirect = location;
+
+    if( accept & (ENC_DEFLATE | ENC_GZIP) )
+    {
+        stored[0] = 0;
+        stored[1] = len & 0xFF;
+        stored[2] = (len >> 8) & 0xFF;
+        stored[3] = ~len & 0xFF;
+        stored[4] = (~len >> 8) & 0xFF;
+
+        if( accept & ENC_DEFLATE )
+        {
+            info.encoding = "deflate";
+            count = add_iov( iov, count, zlib_header, sizeof(zlib_header) );
+
+            check = adler32( 1, (const Bytef*)location, len );
+            check = adler32_combine( start->adler, check, len );
+            check = adler32_combine( check, redirect_end.adler,
+                                     redirect_end.length );
+
+            trailer[0] = (check >> 24) & 0xFF;
+            trailer[1] = (check >> 16) & 0xFF;
+            trailer[2] = (check >> 8) & 0xFF;
+            trailer[3] = check & 0xFF;
+        }
+        else
+        {
+            info.encoding = "gzip";
+            count = add_iov( iov, count, gzip_header, sizeof(gzip_header) );
+
+            check = crc32( 0, (const Bytef*)location, len );
+            check = crc32_combine( start->crc, check, len );
+            check = crc32_combine( check, redirect_end.crc,
+                                   redirect_end.length );
+
+            put_le32( trailer, check );
+            put_le32( trailer + 4,
+                      start->length + len + redirect_end.length );
+        }
+
+        count = add_iov( iov, count, start->packed, start->packed_size );
+        count = add_iov( iov, count, stored, sizeof(stored) );
+        count = add_iov( iov, count, location, len );
+        count = add_iov( iov, count, redirect_end.packed,
+                         redirect_end.packed_size );
+        count = add_iov( iov, count, trailer,
+                         (accept & ENC_DEFLATE) ? 4 : 8 );
+    }
+    else
+    {
+        count = add_iov( iov, count, start->text, start->length );
+        count = add_iov( iov, count, location, len );
+        count = add_iov( iov, count, redirect_end.text, redirect_end.length );
+    }
+
+    for( i = 0; i < (size_t)count; ++i )
+        info.size += iov[i].iov_len;
+
+    return http_send_response_iov( sock, &info, iov, count ) != 0;
+}
+
 const char* http_get_arg( const char* argstr, int args, const char* arg )
 {
     const char* ptr = argstr;
@@ -2,7 +2,9 @@
 #define HTTP_H
 
 #include <stddef.h>
+#include <sys/uio.h>
 
+#include "sock.h"
 #include "str.h"
 
 #define HTTP_GET 0
@@ -19,6 +21,10 @@
 #define FIELD_ACCEPT 5
 #define FIELD_ENCODING 6
 #define FIELD_CONNECTION 7
+#define FIELD_RANGE 8
+#define FIELD_IFRANGE 9
+#define FIELD_IFNOMATCH 10
+#define FIELD_TRANSFER 11
 
 #define ERR_BAD_REQ 1
 #define ERR_NOT_FOUND 2
@@ -32,6 +38,9 @@
 #define ERR_REDIRECT_GET 10
 #define ERR_UNCHANGED 11
 #define ERR_SRV_TIMEOUT 12
+#define ERR_PARTIAL 13
+#define ERR_RANGE 14
+#define ERR_NOT_IMPL 15
 
 /* static page (allow caching for up to 1 day) */
 #define FLAG_STATIC 0x01
@@ -42,17 +51,54 @@
 /* if set, do not allow caching */
 #define FLAG_DYNAMIC 0x04
 
+/* byte ranges of the content can be requested */
+#define FLAG_RANGES 0x08
+
+/* the size is not known in advance, the body is sent in chunks */
+#define FLAG_CHUNKED 0x10
+
+/* the encoding depends on Accept-Encoding, caches have to know that */
+#define FLAG_VARY 0x20
+
 #define ENC_DEFLATE 0x01
 #define ENC_GZIP 0x02
 
 #define REQ_CLOSE 0x01
 
+/* the client speaks HTTP/1.0 and does not understand chunked responses */
+#define REQ_HTTP10 0x02
+
+/* the request body is sent with chunked transfer encoding */
+#define REQ_CHUNKED 0x04
+
+/* the request has a Content-Length field */
+#define REQ_LENGTH 0x08
+
+/* the request body is sent with a transfer coding that is not supported */
+#define REQ_CODING 0x10
+
+/* length of a date in HTTP format, e.g. "Sun, 06 Nov 1994 08:49:37 GMT" */
+#define HTTP_DATE_LENGTH 29
+
+/* maximum number of byte ranges served for a single request */
+#define HTTP_MAX_RANGES 8
+
+/* maximum number of body parts for http_send_response_iov */
+#define HTTP_BODY_IOV (2 * HTTP_MAX_RANGES + 1)
+
+/* buffer size for the ETag values generated for static files */
+#define HTTP_ETAG_LENGTH 72
+
+/* buffer size required for a Content-Range value */
+#define HTTP_RANGE_LENGTH 72
+
+/* separator of the parts of a multipart/byteranges response */
+#define HTTP_BOUNDARY "7d0c9f3b1a5e42e8"
+#define HTTP_MULTIPART_TYPE "multipart/byteranges; boundary=" HTTP_BOUNDARY
+#define HTTP_MULTIPART_END "\r\n--" HTTP_BOUNDARY "--\r\n"
+
 typedef struct
 {
-    char* buffer;   /* static buffer to allocate strings from */
-    size_t size;    /* size of buffer */
-    size_t used;    /* number of buffer bytes used so far */
-
     int flags;            /* misc request flags (REQ_*) */
     int method;           /* request method */
     int numargs;          /* number of get get-arguments */
@@ -66,6 +112,11 @@ typedef struct
     const char* type;     /* content-type */
     const char* getargs;  /* arguments pasted to path string */
     const char* cookies;  /* pointer to cookie args */
+    const char* range;    /* if set, value of the Range field */
+    const char* ifrange;  /* if set, value of the If-Range field */
+    const char* ifnomatch;/* if set, value of the If-None-Match field */
+    struct http_body* body; /* reader for the request body (body.h) */
+    arena* mem;           /* memory released once the request is handled */
 }
 http_request;
 
@@ -79,21 +130,162 @@ typedef struct
     const char* encoding;       /* if set, content encoding */
     const char* redirect;       /* if set, redirect client there */
     const char* setcookies;     /* if set, added via set-cookie field */
+    const char* range;          /* if set, sent as Content-Range value */
+    const char* etag;           /* if set, quoted entity tag of the content */
 }
 http_file_info;
 
+typedef struct
+{
+    unsigned long first;        /* offset of the first byte */
+    unsigned long last;         /* offset of the last byte (inclusive) */
+}
+http_range;
+
+typedef struct
+{
+    http_request* rq;   /* request to initialize */
+    size_t scanned;     /* bytes already searched for the end of header */
+    int status;         /* ERR_* status to reject a malformed request with */
+}
+http_parser;
+
 /* Get a string describing a HTTP_* method ID */
 const char* http_method_to_string( unsigned int method );
 
-size_t http_response_header( int fd, const http_file_info* info );
+/*
+    Write a unix time stamp in HTTP date format to a buffer. The buffer
+    must hold at least HTTP_DATE_LENGTH + 1 bytes.
+ */
+void http_format_date( char* buffer, long timestamp );
+
+/*
+    Get the current time in HTTP date format. The string is rendered
+    at most once per second and shared by all requests.
+ */
+const char* http_current_date( void );
+
+/*
+    Send a response header, followed by a body (if size is not zero),
+    with a single writev call. What the socket does not take right away is
+    queued (see sock_send_iov). Returns the number of bytes in the
+    response, zero on failure.
+ */
+size_t http_send_response( sock_t* sock, const http_file_info* info,
+                           const void* body, size_t size );
+
+/*
+    Render the response header that http_send_response would send into a
+    buffer, e.g. to keep it around for sending it again later. Nothing is
+    written if the header does not fit into the buffer.
+
+    If date is not NULL, the offset of the Date value in the header is
+    stored in it, so the value can be updated via http_current_date.
+
+    Returns the length of the header.
+ */
+size_t http_render_header( char* buffer, size_t size,
+                           const http_file_info* info, size_t* date );
+
+/*
+    Same as http_send_response, but the body is gathered from up to
+    HTTP_BODY_IOV buffers.
+ */
+size_t http_send_response_iov( sock_t* sock, const http_file_info* info,
+                               const struct iovec* body, int count );
+
+/* Send only a response header, see http_send_response */
+size_t http_response_header( sock_t* sock, const http_file_info* info );
 
-/* Parse "METHOD <path> <version>" line and initialize an http request */
-int http_request_init( http_request* rq, const char* request,
-                       char* stringbuffer, size_t size );
+/*
+    Parse "METHOD <path> <version>" line and initialize an http request.
+    The line is modified and the request points into it.
+ */
+int http_request_init( http_request* rq, char* request );
 
-/* Parse a "key: value" attribute line */
+/*
+    Parse a "key: value" attribute line. The line is modified and
+    the request may point into it.
+
+    Returns zero if the field is malformed or not supported (e.g. a
+    second Content-Length), non-zero otherwise.
+ */
 int http_parse_attribute( http_request* rq, char* line );
 
+/* Initialize a resumable parser for a request header */
+void http_parser_init( http_parser* p, http_request* rq );
+
+/*
+    Look for a complete request header in the data received so far and
+    parse it. The data has to start at the beginning of the request and
+    must be passed again, with more data appended, until the header is
+    complete. Only the newly appended part is searched on each call.
+
+    The header is parsed in place: lines are normalized (tabs turned into
+    spaces, backslashes into slashes, other control characters dropped,
+    sequences of spaces and slashes collapsed, lines trimmed), terminated
+    and the strings of the request point into the data, so it has to be
+    kept around until the request has been handled.
+
+    The number of bytes processed is returned through "consumed". Parsing
+    stops right after the end of the request header, so any following data
+    (request body, pipelined requests) is not consumed. Empty lines in
+    front of a request are consumed even if the header is not complete.
+
+    A request that gives its body both a Content-Length and a
+    Transfer-Encoding, or uses a transfer coding other than chunked, is
+    rejected, as its body could not be told apart from the next request.
+
+    Returns a positive value if the request header is complete, zero if
+    more data is needed, a negative value if the request is rejected, with
+    the status to answer it with stored in the parser.
+ */
+int http_parser_feed( http_parser* p, char* data, size_t size,
+                      size_t* consumed );
+
+/*
+    Check the validators sent with a request against the response that
+    would be sent. If the request has an If-None-Match field, it is compared
+    to the entity tag (if the response has one), otherwise If-Modified-Since
+    is compared to the modification time.
+
+    Returns non-zero if the client has an up to date copy, i.e. a "304 Not
+    Modified" response can be sent instead.
+ */
+int http_is_unchanged( const http_request* rq, const http_file_info* info );
+
+/*
+    Get the byte ranges requested for a resource, described by its file
+    info (size, modification time and entity tag). Ranges are only honoured
+    for GET requests and, if the request has an If-Range field, only if it
+    matches the entity tag or the Last-Modified date of the resource.
+
+    At most "max" ranges are stored, in the order they were requested.
+    Ranges past the end of the resource are dropped, the others clamped.
+
+    Returns the number of ranges, zero if the whole resource should be
+    sent (no Range field, malformed or too many ranges), a negative value
+    if none of the requested ranges can be satisfied.
+ */
+int http_get_ranges( const http_request* rq, const http_file_info* info,
+                     http_range* ranges, int max );
+
+/*
+    Write a Content-Range value into a buffer of HTTP_RANGE_LENGTH bytes.
+    If range is NULL, the value for an unsatisfiable request is written.
+ */
+void http_format_range( char* buffer, const http_range* range,
+                        unsigned long size );
+
+/*
+    Render the header in front of a part of a multipart/byteranges body.
+    Nothing is written if it does not fit into the buffer.
+
+    Returns the length of the part header.
+ */
+size_t http_render_part( char* buffer, size_t size, const char* type,
+                         const http_range* range, unsigned long total );
+
 /*
     Write a default page to an _uninitialized_ string and fill the file info
     structure. If the client accepts compressed data, the string is
@@ -104,6 +296,37 @@ int http_parse_attribute( http_request* rq, char* line );
 int gen_default_page(string* page, http_file_info* info,
                      int status, int accept, const char* redirect);
 
+/*
+    Render the default pages for all status codes in every supported
+    encoding, including the response header, as well as the constant parts
+    of redirect pages. Should be called before forking the workers.
+
+    Returns non-zero on success.
+ */
+int http_default_pages_init( void );
+
+/* free the pre-rendered default pages */
+void http_default_pages_cleanup( void );
+
+/*
+    Send the default page for a status code, compressed if the client
+    accepts it. Falls back to generating the page if it has not been
+    rendered in advance.
+
+    Returns non-zero on success.
+ */
+int http_send_default_page( sock_t* sock, int status, int accept );
+
+/*
+    Send a redirect page (ERR_REDIRECT or ERR_REDIRECT_GET) pointing to
+    a location. The compressed forms are assembled from pre-compressed
+    parts around the location, which is sent as is.
+
+    Returns non-zero on success.
+ */
+int http_send_redirect( sock_t* sock, int status, int accept,
+                        const char* location );
+
 /* Get the value of a named argument after using http_split_args. */
 const char* http_get_arg( const char* argstr, int args, const char* arg );
 
@@ -1,3 +1,4 @@
+#include <sys/epoll.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
 #include <arpa/inet.h>
@@ -13,18 +14,73 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <errno.h>
+#include <time.h>
 
 #include "config.h"
 #include "http.h"
+#include "body.h"
 #include "file.h"
 #include "conf.h"
 #include "sock.h"
 #include "rest.h"
 #include "log.h"
 
+#ifdef HAVE_IO_URING
+    #include "uring.h"
+#endif
+
 #define ERR_ALARM -1
 #define ERR_SEGFAULT -2
 
+#define MAX_EVENTS 64
+#define ACCEPT_BATCH 16
+
+#define URING_ENTRIES 256
+#define RECV_BUFFERS 64
+#define RECV_BUFFER_SIZE 4096
+#define XFER_BUFFER_SIZE 65536
+
+/* io_uring operation of a connection, in the low bits of its user_data */
+#define OP_RECV 0
+#define OP_SEND 1               /* queued output held in memory */
+#define OP_READ 2               /* queued file range into the xfer buffer */
+#define OP_SEND_XFER 3          /* xfer buffer to the socket */
+#define OP_MASK 3
+
+typedef struct connection
+{
+    struct connection* prev;
+    struct connection* next;
+    sock_t* sock;
+    http_parser parser;     /* parser for the header being received */
+    http_request req;       /* request parsed from the receive buffer */
+    http_body body;         /* reader for the body of the request */
+    arena mem;              /* memory for handling the current request */
+    cfg_host* host;         /* virtual host of the current request */
+    char* header;           /* buffer the request is in, while the body
+                               is received into the socket's buffer */
+    long deadline;          /* monotonic time in ms at which it times out */
+    unsigned int requests;  /* number of requests handled so far */
+    int last;               /* close once the response has been sent */
+#ifdef HAVE_IO_URING
+    int pending;            /* an io_uring operation is in flight */
+    int closing;            /* close as soon as the operation completes */
+    char* xfer;             /* XFER_BUFFER_SIZE bytes of a file range */
+    size_t xfer_pos;        /* position of the data left to send in xfer */
+    size_t xfer_len;        /* number of bytes left to send in xfer */
+    struct connection* starved; /* next one waiting for receive buffers */
+#endif
+}
+connection;
+
+typedef struct
+{
+    connection* head;       /* connection that times out first */
+    connection* tail;       /* connection that times out last */
+    long timeout;           /* timeout in ms for all connections in list */
+}
+conn_list;
+
 static const struct option options[] =
 {
     { "cfg", required_argument, NULL, 'c' },
@@ -36,6 +92,9 @@ static const struct option options[] =
 };
 
 static sig_atomic_t run = 1;
+static sig_atomic_t reload = 0;
+static volatile sig_atomic_t retired = 0;   /* pid of a worker giving up */
+static long drain_deadline = -1;
 static sigjmp_buf watchdog;
 static const char* configfile;
 static size_t num_pfds = 0;
@@ -43,33 +102,43 @@ static struct pollfd* pfd = NULL;
 static const char* logfile = NULL;
 static const char* rootdir = NULL;
 static int loglevel = LEVEL_WARNING;
+static size_t num_workers = 0;
+static pid_t* workers = NULL;
+static int epfd = -1;
+static unsigned int num_conns = 0;
+static conn_list idle_conns = { NULL, NULL, KEEPALIVE_TIMEOUT_MS };
+static conn_list header_conns = { NULL, NULL, MAX_REQUEST_SECONDS * 1000L };
+static conn_list body_conns = { NULL, NULL, BODY_TIMEOUT_MS };
+static conn_list sending_conns = { NULL, NULL, MAX_FILEXFER_TIMEOUT * 1000L };
+#ifdef HAVE_IO_URING
+static uring_t ring;
+static char* recv_buffers = NULL;
+static connection* starved = NULL;  /* receives that ran out of buffers */
+#endif
 
 static void main_proc_handler( int sig )
 {
     if( sig == SIGHUP )
-    {
-        INFO("re-reading config file %s", configfile);
-        config_cleanup( );
-        config_read( configfile );
-        config_set_user( );
-    }
+        reload = 1;
     if( sig == SIGTERM || sig == SIGINT )
         run = 0;
 }
 
-static void sighandler( int sig )
+static void retire_handler( int sig, siginfo_t* info, void* context )
 {
-    if( sig == SIGCHLD )
-    {
-        while( waitpid( -1, NULL, WNOHANG )!=-1 ) { }
-    }
+    (void)sig; (void)context;
+    retired = info->si_pid;
+}
 
+/* the signal mask is restored, the worker keeps running for a while */
+static void sighandler( int sig )
+{
     if( sig == SIGALRM )
-        longjmp( watchdog, ERR_ALARM );
+        siglongjmp( watchdog, ERR_ALARM );
     if( sig == SIGSEGV )
     {
         print_stacktrace( );
-        longjmp( watchdog, ERR_SEGFAULT );
+        siglongjmp( watchdog, ERR_SEGFAULT );
     }
 }
 
@@ -83,133 +152,98 @@ static void init_sig_handlers(void)
     sigaction( SIGTERM, &act, NULL );
     sigaction( SIGINT, &act, NULL );
     sigaction( SIGHUP, &act, NULL );
+    sigaction( SIGCHLD, &act, NULL );
 
     act.sa_handler = sighandler;
-    sigaction( SIGCHLD, &act, NULL );
     sigaction( SIGALRM, &act, NULL );
     sigaction( SIGSEGV, &act, NULL );
 
     act.sa_handler = SIG_IGN;
     sigaction( SIGPIPE, &act, NULL );
+
+    act.sa_sigaction = retire_handler;
+    act.sa_flags = SA_SIGINFO;
+    sigaction( SIGUSR1, &act, NULL );
 }
 
-static int read_header( sock_t* sock, http_request* req,
-                        char* buffer, size_t size )
+static void init_worker_sig_handlers(void)
 {
-    char line[512];
-    int ret;
+    struct sigaction act;
 
-    ret = read_line( sock, line, sizeof(line), KEEPALIVE_TIMEOUT_MS );
-    if( ret == 0 ) return ERR_BAD_REQ;
-    if( ret <  0 ) return ERR_TIMEOUT;
+    memset( &act, 0, sizeof(act) );
 
-    if( !http_request_init( req, line, buffer, size ) )
-    {
-        DBG( "Error parsing line '%s'", line );
-        return ERR_BAD_REQ;
-    }
+    act.sa_handler = SIG_IGN;
+    sigaction( SIGHUP, &act, NULL );
+    sigaction( SIGUSR1, &act, NULL );
 
-    INFO( "Request: %s", line );
+    act.sa_handler = SIG_DFL;
+    sigaction( SIGCHLD, &act, NULL );
+}
 
-    while( 1 )
-    {
-        ret = read_line( sock, line, sizeof(line), KEEPALIVE_TIMEOUT_MS );
-        if( ret == 0 ) return ERR_BAD_REQ;
-        if( ret <  0 ) return ERR_TIMEOUT;
-        if( !line[0] )
-            break;
-        http_parse_attribute( req, line );
-    }
-    return 0;
+static void send_default_page( sock_t* sock, int status, int accept )
+{
+    http_send_default_page( sock, status, accept );
 }
 
-static void handle_client( sock_t* sock )
+/*
+    Process a single request whose header and body have been received.
+    Returns a positive value if the connection can be kept open, zero if
+    it has to be closed. Returns a negative value if the watchdog had to
+    interrupt request handling, in which case the state of the process is
+    not trustworthy anymore and the worker has to exit.
+ */
+static int handle_request( sock_t* sock, cfg_host* h, http_request* req )
 {
-    http_file_info info;
-    char buffer[2048];
-    http_request req;
-    size_t count;
-    cfg_host* h;
-    string page;
     int ret;
 
-    memset( &req, 0, sizeof(req) );
-    req.method = -1;
-
-    if( (ret = setjmp(watchdog))!=0 )
+    if( (ret = sigsetjmp(watchdog, 1))!=0 )
     {
         alarm(0);
         goto fail_sig;
     }
 
-    for( count = 0; count < MAX_REQUESTS; ++count )
-    {
-        if( !sock_wait( sock, KEEPALIVE_TIMEOUT_MS ) )
-            break;
-
-        alarm( MAX_REQUEST_SECONDS );
+    alarm( MAX_REQUEST_SECONDS );
 
-        ret = read_header( sock, &req, buffer, sizeof(buffer) );
-        if( ret != 0 )
-            goto fail;
+    INFO( "Request: %s/%s", http_method_to_string(req->method), req->path );
 
-        ret = ERR_BAD_REQ;
-        if( !(h = config_find_host( req.host )) )
-            goto fail;
-
-        ret = ERR_NOT_FOUND;
-        if( !req.path || !req.path[0] )
-            req.path = h->rootfile;
-
-        if( req.path && req.path[0] )
-        {
-        #ifdef HAVE_REST
-            if( h->restdir && ret == ERR_NOT_FOUND )
-                ret = rest_handle_request( sock, h, &req );
-        #endif
-        #ifdef HAVE_STATIC
-            if( h->datadir > 0 && ret == ERR_NOT_FOUND )
-            {
-                alarm( MAX_FILEXFER_TIMEOUT );
-                ret = http_send_file( h->datadir, sock->fd, &req );
-            }
-        #endif
-        }
+    ret = ERR_NOT_FOUND;
+    if( req->path && req->path[0] )
+    {
+    #ifdef HAVE_REST
+        if( h->restdir && ret == ERR_NOT_FOUND )
+            ret = rest_handle_request( sock, h, req );
+    #endif
+    #ifdef HAVE_STATIC
+        if( h->datadir > 0 && ret == ERR_NOT_FOUND )
+            ret = http_send_file( h->datadir, sock, req );
+    #endif
+    }
 
-        if( ret && gen_default_page( &page, &info, ret, req.accept, NULL ) )
-        {
-            http_response_header( sock->fd, &info );
-            write( sock->fd, page.data, page.used );
-            string_cleanup( &page );
-        }
+    if( ret )
+        send_default_page( sock, ret, req->accept );
 
-        alarm( 0 );
+    /* the next request starts after the body */
+    if( !body_finish( req->body ) )
+        req->flags |= REQ_CLOSE;
 
-        if( req.flags & REQ_CLOSE )
-            break;
-    }
-    return;
+    alarm( 0 );
+    return !(req->flags & REQ_CLOSE);
 fail_sig:
     if( ret == ERR_SEGFAULT )
     {
         CRITICAL( "SEGFAULT!! Host: '%s', Request: %s/%s",
-                  req.host, http_method_to_string(req.method), req.path );
+                  req->host, http_method_to_string(req->method), req->path );
         ret = ERR_INTERNAL;
     }
     else
     {
         WARN( "Watchdog timeout! Host: '%s', Request: %s/%s",
-              req.host, http_method_to_string(req.method), req.path );
+              req->host, http_method_to_string(req->method), req->path );
         ret = ERR_SRV_TIMEOUT;
     }
-fail:
-    if( gen_default_page( &page, &info, ret, req.accept, NULL ) )
-    {
-        http_response_header( sock->fd, &info );
-        write( sock->fd, page.data, page.used );
-        string_cleanup( &page );
-    }
+    send_default_page( sock, ret, req->accept );
     alarm( 0 );
+    return -1;
 }
 
 static void usage( int status )
@@ -246,6 +280,14 @@ static int create_sockets(void)
             return 0;
         }
 
+        /* all workers poll the same sockets, only one wins the accept */
+        if( fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK ) != 0 )
+        {
+            CRITICAL( "fcntl %s: %s", s->bind, strerror(errno) );
+            close( fd );
+            return 0;
+        }
+
         if( num_pfds == max )
         {
             max += 10;
@@ -274,6 +316,971 @@ static void destroy_sockets(void)
     free( pfd );
 }
 
+static long get_time_ms( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static conn_list* get_list( const connection* c )
+{
+    switch( c->sock->state )
+    {
+    case SOCK_IDLE:    return &idle_conns;
+    case SOCK_HEADER:  return &header_conns;
+    case SOCK_BODY:    return &body_conns;
+    case SOCK_SENDING: return &sending_conns;
+    }
+    return NULL;
+}
+
+static void set_state( connection* c, int state )
+{
+    conn_list* l;
+
+    if( c->sock->state == state )
+        return;
+
+    if( (l = get_list( c )) )
+    {
+        if( c->prev ) c->prev->next = c->next;
+        else          l->head = c->next;
+        if( c->next ) c->next->prev = c->prev;
+        else          l->tail = c->prev;
+        c->prev = c->next = NULL;
+    }
+
+    c->sock->state = state;
+
+    if( (l = get_list( c )) )
+    {
+        c->deadline = get_time_ms( ) + l->timeout;
+        c->prev = l->tail;
+        if( l->tail ) l->tail->next = c;
+        else          l->head = c;
+        l->tail = c;
+    }
+}
+
+static void close_connection( connection* c )
+{
+    set_state( c, SOCK_BUSY );
+
+#ifdef HAVE_IO_URING
+    /* wake up the operation, the connection is freed once it completes */
+    if( c->pending )
+    {
+        if( !c->closing )
+            shutdown( c->sock->fd, SHUT_RDWR );
+        c->closing = 1;
+        return;
+    }
+
+    free( c->xfer );
+#endif
+
+    /* the fd is not shared, closing it removes it from the epoll set */
+    destroy_wrapper( c->sock );
+    body_cleanup( &c->body );
+    arena_cleanup( &c->mem );
+    free( c->header );
+    free( c );
+    --num_conns;
+}
+
+static connection* add_connection( int fd )
+{
+    connection* c;
+
+    /* make room by dropping the connection closest to timing out */
+    if( num_conns >= config_get_workers( )->connections )
+    {
+        if( idle_conns.head )
+            close_connection( idle_conns.head );
+        else if( header_conns.head )
+            close_connection( header_conns.head );
+    }
+
+    if( !(c = calloc( 1, sizeof(*c) )) )
+        goto fail;
+
+    if( !(c->sock = create_wrapper( fd )) )
+    {
+        free( c );
+        goto fail;
+    }
+
+    arena_init( &c->mem, 0 );
+    http_parser_init( &c->parser, &c->req );
+    c->body.fd = -1;
+    c->sock->state = SOCK_BUSY;
+    set_state( c, SOCK_IDLE );
+    ++num_conns;
+    return c;
+fail:
+    CRITICAL("Out of memory");
+    close( fd );
+    return NULL;
+}
+
+/* size limit for receiving the body of a request, see BODY_SKIP_MAX */
+static unsigned long body_max( const connection* c )
+{
+    unsigned long max = BODY_SKIP_MAX;
+#ifdef HAVE_REST
+    unsigned long rest;
+
+    if( c->host->restdir && (rest = rest_max_body( c->host, &c->req )) > max )
+        max = rest;
+#endif
+    return max;
+}
+
+/*
+    Look up the host of a request whose header has just been parsed and
+    set up the reader for its body. Returns zero on success, otherwise the
+    ERR_* value to answer the request with.
+ */
+static int start_request( connection* c )
+{
+    http_request* req = &c->req;
+
+    if( !(c->host = config_find_host( req->host )) )
+        return ERR_BAD_REQ;
+
+    if( !req->path || !req->path[0] )
+        req->path = c->host->rootfile;
+
+    req->body = &c->body;
+    req->mem = &c->mem;
+    body_init( req->body, req, &c->mem, body_max( c ) );
+    return 0;
+}
+
+/*
+    Called when the watchdog had to interrupt a request, after which the
+    state of the worker cannot be trusted. The main process starts a
+    replacement right away, while this worker only finishes its other
+    connections (see keep_running) and exits.
+ */
+static void retire_worker( void )
+{
+    if( run )
+        kill( getppid( ), SIGUSR1 );
+    run = 0;
+}
+
+/*
+    Parse the request headers in the receive buffer of a connection, take
+    in their bodies and handle all requests that are complete. Returns a
+    positive value if the connection is still open, waiting for data or
+    for the socket to take the rest of a response (SOCK_SENDING), zero if
+    it has been closed.
+ */
+static int process_requests( connection* c )
+{
+    sock_t* sock = c->sock;
+    size_t consumed;
+    int ret;
+
+    for( ;; )
+    {
+        if( sock->state != SOCK_BODY )
+        {
+            if( !sock->buffer || sock->offset >= sock->size )
+                break;
+
+            ret = http_parser_feed( &c->parser, sock->buffer + sock->offset,
+                                    sock->size - sock->offset, &consumed );
+            sock->offset += consumed;
+
+            if( ret < 0 )
+            {
+                send_default_page( sock, c->parser.status, 0 );
+                goto fail;
+            }
+
+            if( ret == 0 )
+                break;
+
+            if( (ret = start_request( c )) != 0 )
+            {
+                send_default_page( sock, ret, c->req.accept );
+                goto fail;
+            }
+        }
+
+        if( (ret = body_receive( c->req.body, sock )) < 0 )
+        {
+            send_default_page( sock, c->req.body->error, c->req.accept );
+            goto fail;
+        }
+
+        if( ret == 0 )
+        {
+            /* the request points into the buffer, which is all used up */
+            if( !c->header )
+            {
+                c->header = sock->buffer;
+                sock->buffer = NULL;
+                sock->offset = sock->size = 0;
+            }
+            set_state( c, SOCK_BODY );
+            return 1;
+        }
+
+        set_state( c, SOCK_BUSY );
+
+        /* only the connection that caused it is dropped right away */
+        if( (ret = handle_request( sock, c->host, &c->req )) < 0 )
+        {
+            retire_worker( );
+            goto fail;
+        }
+
+        body_cleanup( &c->body );
+        arena_reset( &c->mem );
+        free( c->header );
+        c->header = NULL;
+
+        /* the rest of a response that broke off is of no use */
+        if( sock->failed )
+            goto fail;
+
+        if( !ret || !run || ++c->requests >= MAX_REQUESTS )
+            c->last = 1;
+        else
+            http_parser_init( &c->parser, &c->req );
+
+        /* further requests wait until the socket has taken the response */
+        if( sock->out )
+        {
+            set_state( c, SOCK_SENDING );
+            return 1;
+        }
+
+        if( c->last )
+            goto fail;
+    }
+
+    /* like the receive buffer, an idle connection keeps no memory */
+    sock_release_buffer( sock );
+    if( !sock->buffer )
+        arena_cleanup( &c->mem );
+
+    set_state( c, sock->buffer ? SOCK_HEADER : SOCK_IDLE );
+    return 1;
+fail:
+    close_connection( c );
+    return 0;
+}
+
+/*
+    Send more of a response that the socket did not take at once. After
+    the last of it, the connection is closed if it was the last response,
+    otherwise the requests received in the meantime are handled. Returns
+    the same as process_requests.
+ */
+static int send_pending( connection* c )
+{
+    int ret = sock_flush( c->sock );
+
+    if( ret == 0 )
+        return 1;
+
+    if( ret < 0 || c->last )
+    {
+        close_connection( c );
+        return 0;
+    }
+
+    return process_requests( c );
+}
+
+static void expire_connections( conn_list* l, long now, int status )
+{
+    while( l->head && l->head->deadline <= now )
+    {
+        if( status )
+            send_default_page( l->head->sock, status, 0 );
+        close_connection( l->head );
+    }
+}
+
+static void expire_all_connections( void )
+{
+    long now = get_time_ms( );
+
+    expire_connections( &idle_conns, now, 0 );
+    expire_connections( &header_conns, now, ERR_TIMEOUT );
+    expire_connections( &body_conns, now, ERR_TIMEOUT );
+    expire_connections( &sending_conns, now, 0 );
+}
+
+/* earlier of a deadline and the first one in a list (negative for none) */
+static long first_deadline( long deadline, const conn_list* l )
+{
+    if( l->head && (deadline < 0 || l->head->deadline < deadline) )
+        return l->head->deadline;
+    return deadline;
+}
+
+static int get_timeout( long now )
+{
+    long deadline = -1;
+
+    deadline = first_deadline( deadline, &idle_conns );
+    deadline = first_deadline( deadline, &header_conns );
+    deadline = first_deadline( deadline, &body_conns );
+    deadline = first_deadline( deadline, &sending_conns );
+
+    if( drain_deadline >= 0 && (deadline < 0 || drain_deadline < deadline) )
+        deadline = drain_deadline;
+
+    if( deadline < 0 )
+        return -1;
+
+    return deadline > now ? (deadline - now) : 0;
+}
+
+static void close_all_connections( void )
+{
+    while( idle_conns.head )
+        close_connection( idle_conns.head );
+    while( header_conns.head )
+        close_connection( header_conns.head );
+    while( body_conns.head )
+        close_connection( body_conns.head );
+    while( sending_conns.head )
+        close_connection( sending_conns.head );
+}
+
+/*
+    Once the worker is told to stop, it stops accepting connections and
+    closes the idle ones, but keeps serving the others until they are
+    done or DRAIN_TIMEOUT has passed. Returns non-zero while the event
+    loop has to go on.
+ */
+static int keep_running( void (*stop_accepting)( void ) )
+{
+    if( run )
+        return 1;
+
+    if( drain_deadline < 0 )
+    {
+        drain_deadline = get_time_ms( ) + DRAIN_TIMEOUT * 1000L;
+        stop_accepting( );
+    }
+
+    while( idle_conns.head )
+        close_connection( idle_conns.head );
+
+    return num_conns && get_time_ms( ) < drain_deadline;
+}
+
+/****************************************************************************/
+
+static void accept_connections( int listenfd )
+{
+    struct epoll_event ev;
+    connection* c;
+    int i, fd;
+
+    for( i = 0; i < ACCEPT_BATCH; ++i )
+    {
+        if( (fd = accept4( listenfd, NULL, NULL,
+                           SOCK_CLOEXEC | SOCK_NONBLOCK )) < 0 )
+            break;
+
+        if( !(c = add_connection( fd )) )
+            continue;
+
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.ptr = c;
+
+        if( epoll_ctl( epfd, EPOLL_CTL_ADD, fd, &ev ) != 0 )
+            close_connection( c );
+    }
+}
+
+/*
+    Send more of a pending response, or receive data on a connection and
+    handle all complete requests in the read buffer.
+ */
+static void connection_event( connection* c )
+{
+    int ret, sending = (c->sock->state == SOCK_SENDING);
+    struct epoll_event ev;
+
+    if( sending )
+    {
+        ret = send_pending( c );
+    }
+    else
+    {
+        ret = sock_fill( c->sock );
+
+        if( ret < 0 && (errno == EINTR || errno == EAGAIN) )
+            return;
+
+        if( ret <= 0 )
+        {
+            if( ret < 0 && errno == ENOBUFS )
+                send_default_page( c->sock, ERR_BAD_REQ, 0 );
+            close_connection( c );
+            return;
+        }
+
+        ret = process_requests( c );
+    }
+
+    if( !ret )
+        return;
+
+    /* requests received while sending wait until the response is out */
+    if( sending != (c->sock->state == SOCK_SENDING) )
+    {
+        ev.events = sending ? (EPOLLIN | EPOLLRDHUP) : EPOLLOUT;
+        ev.data.ptr = c;
+
+        if( epoll_ctl( epfd, EPOLL_CTL_MOD, c->sock->fd, &ev ) != 0 )
+            close_connection( c );
+    }
+}
+
+static void epoll_stop_accepting( void )
+{
+    size_t j;
+
+    for( j = 0; j < num_pfds; ++j )
+        epoll_ctl( epfd, EPOLL_CTL_DEL, pfd[j].fd, NULL );
+}
+
+static void epoll_worker_main( void )
+{
+    struct epoll_event ev[ MAX_EVENTS ];
+    int i, count, accepting;
+    size_t j;
+
+    if( (epfd = epoll_create1( EPOLL_CLOEXEC )) < 0 )
+    {
+        CRITICAL( "epoll_create1: %s", strerror(errno) );
+        return;
+    }
+
+    /* listening sockets are tagged with their index in the pfd array */
+    for( j = 0; j < num_pfds; ++j )
+    {
+        ev[0].events = EPOLLIN | EPOLLEXCLUSIVE;
+        ev[0].data.u64 = j;
+
+        if( epoll_ctl( epfd, EPOLL_CTL_ADD, pfd[j].fd, ev ) != 0 )
+        {
+            CRITICAL( "epoll_ctl: %s", strerror(errno) );
+            goto out;
+        }
+    }
+
+    while( keep_running( epoll_stop_accepting ) )
+    {
+        count = epoll_wait( epfd, ev, MAX_EVENTS, get_timeout(get_time_ms()) );
+
+        /* accept after handling connections, accepting can close some */
+        for( accepting = 0, i = 0; i < count; ++i )
+        {
+            if( ev[i].data.u64 < num_pfds )
+                accepting = 1;
+            else
+                connection_event( ev[i].data.ptr );
+        }
+
+        for( i = 0; accepting && run && i < count; ++i )
+        {
+            if( ev[i].data.u64 < num_pfds )
+                accept_connections( pfd[ ev[i].data.u64 ].fd );
+        }
+
+        expire_all_connections( );
+    }
+out:
+    close_all_connections( );
+    close( epfd );
+}
+
+/****************************************************************************/
+
+#ifdef HAVE_IO_URING
+static struct io_uring_sqe* get_sqe( void )
+{
+    struct io_uring_sqe* sqe = uring_get_sqe( &ring );
+
+    /* flush the submission queue if it is full */
+    if( !sqe )
+    {
+        uring_submit( &ring, 0, -1 );
+        sqe = uring_get_sqe( &ring );
+    }
+    return sqe;
+}
+
+/*
+    Queue a receive into one of the provided buffers, while waiting for a
+    request header or body.
+ */
+static void queue_recv( connection* c )
+{
+    struct io_uring_sqe* sqe = get_sqe( );
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = c->sock->fd;
+    sqe->len = RECV_BUFFER_SIZE;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = (unsigned long)c | OP_RECV;
+    c->pending = 1;
+}
+
+static void queue_send_buffer( connection* c, const char* data, size_t size,
+                               int op )
+{
+    struct io_uring_sqe* sqe = get_sqe( );
+
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = c->sock->fd;
+    sqe->addr = (unsigned long)data;
+    sqe->len = size;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long)c | op;
+}
+
+/*
+    Queue sending the head of the output queue of a connection. The kernel
+    retries a send by itself once the socket is writable. A file range is
+    read into the xfer buffer of the connection first, which takes no
+    system call of its own for cached files. Splicing would avoid the copy,
+    but io_uring can only splice on helper threads, which held up the
+    accepts of the worker in testing. Returns zero on failure.
+ */
+static int queue_send( connection* c )
+{
+    sock_seg* seg = c->sock->out;
+    struct io_uring_sqe* sqe;
+
+    if( c->xfer_len )
+    {
+        queue_send_buffer( c, c->xfer + c->xfer_pos, c->xfer_len,
+                           OP_SEND_XFER );
+    }
+    else if( seg->filefd >= 0 )
+    {
+        if( !c->xfer && !(c->xfer = malloc( XFER_BUFFER_SIZE )) )
+            return 0;
+
+        sqe = get_sqe( );
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = seg->filefd;
+        sqe->addr = (unsigned long)c->xfer;
+        sqe->len = seg->size < XFER_BUFFER_SIZE ? seg->size
+                                                : XFER_BUFFER_SIZE;
+        sqe->off = seg->offset;
+        sqe->user_data = (unsigned long)c | OP_READ;
+    }
+    else
+    {
+        queue_send_buffer( c, seg->data + seg->offset, seg->size, OP_SEND );
+    }
+
+    c->pending = 1;
+    return 1;
+}
+
+/* queue whatever a connection waits for next */
+static void queue_next( connection* c )
+{
+    if( c->sock->state != SOCK_SENDING )
+        queue_recv( c );
+    else if( !queue_send( c ) )
+        close_connection( c );
+}
+
+/* hand a range of receive buffers (back) to the kernel */
+static void provide_buffers( unsigned int bid, unsigned int count )
+{
+    struct io_uring_sqe* sqe = get_sqe( );
+
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = count;
+    sqe->addr = (unsigned long)(recv_buffers + bid * RECV_BUFFER_SIZE);
+    sqe->len = RECV_BUFFER_SIZE;
+    sqe->off = bid;
+    sqe->buf_group = 0;
+    sqe->user_data = num_pfds;
+}
+
+/* listening sockets are tagged with their index in the pfd array */
+static void queue_accept( size_t j )
+{
+    struct io_uring_sqe* sqe = get_sqe( );
+
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = pfd[j].fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC | SOCK_NONBLOCK;
+    sqe->user_data = j;
+}
+
+static void uring_stop_accepting( void )
+{
+    struct io_uring_sqe* sqe;
+    size_t j;
+
+    for( j = 0; j < num_pfds; ++j )
+    {
+        sqe = get_sqe( );
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = j;
+        sqe->user_data = num_pfds + 1;
+    }
+}
+
+static void recv_complete( connection* c, int res, unsigned int flags )
+{
+    unsigned int bid;
+    int ret = 1;
+
+    c->pending = 0;
+
+    if( flags & IORING_CQE_F_BUFFER )
+    {
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+
+        if( res > 0 && !c->closing )
+            ret = sock_append( c->sock, recv_buffers + bid * RECV_BUFFER_SIZE,
+                               res );
+
+        provide_buffers( bid, 1 );
+    }
+
+    if( c->closing )
+    {
+        close_connection( c );
+        return;
+    }
+
+    /* retried once the buffers handed back have actually arrived */
+    if( res == -ENOBUFS )
+    {
+        c->pending = 1;
+        c->starved = starved;
+        starved = c;
+        return;
+    }
+
+    if( res == -EINTR || res == -EAGAIN )
+    {
+        queue_recv( c );
+        return;
+    }
+
+    if( res <= 0 || !ret )
+    {
+        if( !ret && errno == ENOBUFS )
+            send_default_page( c->sock, ERR_BAD_REQ, 0 );
+        close_connection( c );
+        return;
+    }
+
+    if( process_requests( c ) )
+        queue_next( c );
+}
+
+/*
+    A part of a pending response has been sent (or read into the xfer
+    buffer). Once all of it is out, the connection goes on like in
+    send_pending.
+ */
+static void send_complete( connection* c, int op, int res )
+{
+    c->pending = 0;
+
+    if( c->closing )
+    {
+        close_connection( c );
+        return;
+    }
+
+    if( res == -EINTR || res == -EAGAIN )
+    {
+        queue_next( c );
+        return;
+    }
+
+    if( res <= 0 )
+    {
+        close_connection( c );
+        return;
+    }
+
+    if( op == OP_SEND_XFER )
+    {
+        c->xfer_pos += res;
+        c->xfer_len -= res;
+    }
+    else
+    {
+        sock_consume( c->sock, res );
+    }
+
+    if( op == OP_READ )
+    {
+        c->xfer_pos = 0;
+        c->xfer_len = res;
+    }
+
+    if( c->xfer_len || c->sock->out )
+    {
+        queue_next( c );
+        return;
+    }
+
+    /* only kept while a response is being sent */
+    free( c->xfer );
+    c->xfer = NULL;
+
+    if( c->last )
+        close_connection( c );
+    else if( process_requests( c ) )
+        queue_next( c );
+}
+
+/* queue the receives again that had to wait for buffers */
+static void retry_starved( void )
+{
+    connection* c;
+
+    while( (c = starved) )
+    {
+        starved = c->starved;
+        c->starved = NULL;
+        c->pending = 0;
+
+        if( c->closing )
+            close_connection( c );
+        else
+            queue_recv( c );
+    }
+}
+
+/*
+    Run the worker event loop on top of io_uring. Returns zero if io_uring
+    cannot be used, so the caller can fall back to epoll.
+ */
+static int uring_worker_main( void )
+{
+    struct io_uring_cqe* cqe;
+    unsigned long tag;
+    unsigned int flags;
+    connection* c;
+    size_t j;
+    int res;
+
+    if( !uring_init( &ring, URING_ENTRIES ) )
+        return 0;
+
+    /* older kernels fail multishot accepts, which would be requeued forever */
+    if( !uring_has_multishot_accept( &ring ) )
+    {
+        uring_cleanup( &ring );
+        return 0;
+    }
+
+    if( !(recv_buffers = malloc( RECV_BUFFERS * RECV_BUFFER_SIZE )) )
+    {
+        CRITICAL("Out of memory");
+        goto out;
+    }
+
+    provide_buffers( 0, RECV_BUFFERS );
+
+    for( j = 0; j < num_pfds; ++j )
+        queue_accept( j );
+
+    while( keep_running( uring_stop_accepting ) )
+    {
+        res = uring_submit( &ring, 1, get_timeout( get_time_ms( ) ) );
+
+        if( res < 0 && res != -ETIME && res != -EINTR )
+        {
+            CRITICAL( "io_uring_enter: %s", strerror(-res) );
+            goto out;
+        }
+
+        while( (cqe = uring_peek_cqe( &ring )) )
+        {
+            tag = cqe->user_data;
+            flags = cqe->flags;
+            res = cqe->res;
+            uring_cqe_seen( &ring );
+
+            if( tag < num_pfds )
+            {
+                if( res >= 0 && (c = add_connection( res )) )
+                    queue_recv( c );
+                if( run && !(flags & IORING_CQE_F_MORE) )
+                    queue_accept( tag );
+            }
+            else if( tag == num_pfds )
+            {
+                if( res < 0 )
+                    CRITICAL( "provide buffers: %s", strerror(-res) );
+                else
+                    retry_starved( );
+            }
+            else if( tag == num_pfds + 1 )
+            {
+                continue;   /* accepts cancelled, see uring_stop_accepting */
+            }
+            else if( tag & OP_MASK )
+            {
+                send_complete( (connection*)(tag & ~(unsigned long)OP_MASK),
+                               tag & OP_MASK, res );
+            }
+            else
+            {
+                recv_complete( (connection*)tag, res, flags );
+            }
+        }
+
+        expire_all_connections( );
+    }
+out:
+    close_all_connections( );
+    uring_cleanup( &ring );
+    free( recv_buffers );
+    return 1;
+}
+#endif /* HAVE_IO_URING */
+
+static void worker_main( void )
+{
+#ifdef HAVE_IO_URING
+    if( uring_worker_main( ) )
+        return;
+    WARN( "io_uring not available, falling back to epoll" );
+#endif
+    epoll_worker_main( );
+}
+
+static int spawn_worker( size_t i, const sigset_t* oldmask )
+{
+    pid_t pid = fork( );
+
+    if( pid < 0 )
+    {
+        CRITICAL( "fork: %s", strerror(errno) );
+        return 0;
+    }
+
+    if( pid == 0 )
+    {
+        init_worker_sig_handlers( );
+        sigprocmask( SIG_SETMASK, oldmask, NULL );
+        worker_main( );
+        exit( EXIT_SUCCESS );
+    }
+
+    workers[i] = pid;
+    return 1;
+}
+
+static int resize_pool( void )
+{
+    size_t i, count = config_get_workers( )->count;
+    pid_t* new;
+
+    /* old workers stop accepting, finish their connections and exit */
+    for( i = 0; i < num_workers; ++i )
+    {
+        if( workers[i] > 0 )
+            kill( workers[i], SIGTERM );
+    }
+
+    if( !(new = calloc( count, sizeof(new[0]) )) )
+    {
+        CRITICAL("Out of memory\n");
+        return 0;
+    }
+
+    free( workers );
+    workers = new;
+    num_workers = count;
+    return 1;
+}
+
+static void supervise( const sigset_t* oldmask )
+{
+    int status;
+    size_t i;
+    pid_t pid;
+
+    while( run )
+    {
+        /* a worker that had to give up gets replaced before it is gone */
+        if( retired )
+        {
+            for( i = 0; i < num_workers; ++i )
+            {
+                if( workers[i] == retired )
+                    workers[i] = 0;
+            }
+            retired = 0;
+        }
+
+        while( (pid = waitpid( -1, &status, WNOHANG )) > 0 )
+        {
+            for( i = 0; i < num_workers; ++i )
+            {
+                if( workers[i] == pid )
+                    workers[i] = 0;
+            }
+
+            if( WIFSIGNALED(status) )
+                WARN( "worker %d killed by signal %d", pid, WTERMSIG(status) );
+        }
+
+        if( reload )
+        {
+            INFO("re-reading config file %s", configfile);
+            reload = 0;
+            config_cleanup( );
+            config_read( configfile );
+            config_set_user( );
+        #ifdef HAVE_STATIC
+            if( !http_file_cache_init( ) )
+                WARN( "could not set up static file cache" );
+        #endif
+            resize_pool( );
+        }
+
+        for( i = 0; run && i < num_workers; ++i )
+        {
+            if( !workers[i] && !spawn_worker( i, oldmask ) )
+                break;
+        }
+
+        if( run )
+            sigsuspend( oldmask );
+    }
+
+    for( i = 0; i < num_workers; ++i )
+    {
+        if( workers[i] > 0 )
+            kill( workers[i], SIGTERM );
+    }
+}
+
 static int process_args( int argc, char** argv )
 {
     int i, j;
@@ -315,9 +1322,8 @@ static int process_args( int argc, char** argv )
 
 int main( int argc, char** argv )
 {
-    int fd, ret = EXIT_FAILURE;
-    sock_t* wrapper;
-    size_t j;
+    int ret = EXIT_FAILURE;
+    sigset_t mask, oldmask;
 
     init_sig_handlers();
 
@@ -366,32 +1372,31 @@ int main( int argc, char** argv )
         goto fail;
     }
 
-    while( run )
-    {
-        if( poll( pfd, num_pfds, -1 )<=0 )
-            continue;
+    sigemptyset( &mask );
+    sigaddset( &mask, SIGCHLD );
+    sigaddset( &mask, SIGTERM );
+    sigaddset( &mask, SIGINT );
+    sigaddset( &mask, SIGHUP );
+    sigaddset( &mask, SIGUSR1 );
+    sigprocmask( SIG_BLOCK, &mask, &oldmask );
 
-        for( j=0; j<num_pfds; ++j )
-        {
-            if( !(pfd[j].revents & POLLIN) )
-                continue;
+#ifdef HAVE_STATIC
+    if( !http_file_cache_init( ) )
+        WARN( "could not set up static file cache" );
+#endif
 
-            fd = accept( pfd[j].fd, NULL, NULL );
+    if( !http_default_pages_init( ) )
+        WARN( "could not render default pages" );
 
-            if( fd >= 0 && fork( ) == 0 )
-            {
-                wrapper = create_wrapper( fd );
-                if( !wrapper )
-                    exit( EXIT_FAILURE );
-                handle_client( wrapper );
-                destroy_wrapper( wrapper );
-                exit( EXIT_SUCCESS );
-            }
+    if( !resize_pool( ) )
+        goto out;
 
-            if( fd >= 0 )
-                close( fd );
-        }
-    }
+    supervise( &oldmask );
+
+#ifdef HAVE_STATIC
+    /* lets the background compressor exit once the workers are gone */
+    http_file_cache_cleanup( );
+#endif
 
     signal( SIGCHLD, SIG_IGN );
     while( wait(NULL)!=-1 ) { }
@@ -399,8 +1404,13 @@ int main( int argc, char** argv )
     ret = EXIT_SUCCESS;
 out:
     INFO("shutting down");
+#ifdef HAVE_STATIC
+    http_file_cache_cleanup( );
+#endif
+    http_default_pages_cleanup( );
     config_cleanup( );
     destroy_sockets( );
+    free( workers );
     return ret;
 fail:
     CRITICAL("Try '%s --help' for more information\n", argv[0]);
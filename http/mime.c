@@ -0,0 +1,174 @@
+#include "mime.h"
+#include "conf.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+static struct {const char* ending; const char* mime; int flags;} mimemap[] =
+{
+    { "js",   "application/javascript; charset=utf-8", FLAG_STATIC },
+    { "json", "application/json; charset=utf-8", FLAG_STATIC       },
+    { "xml",  "application/xml; charset=utf-8", FLAG_STATIC        },
+    { "html", "text/html; charset=utf-8", FLAG_STATIC              },
+    { "htm",  "text/html; charset=utf-8", FLAG_STATIC              },
+    { "css",  "text/css; charset=utf-8", FLAG_STATIC               },
+    { "csv",  "text/csv; charset=utf-8", FLAG_STATIC               },
+    { "pdf",  "application/pdf", FLAG_STATIC_RESOURCE              },
+    { "zip",  "application/zip", FLAG_STATIC_RESOURCE              },
+    { "gz",   "application/gzip", FLAG_STATIC_RESOURCE             },
+    { "png",  "image/png", FLAG_STATIC_RESOURCE                    },
+    { "bmp",  "image/bmp", FLAG_STATIC_RESOURCE                    },
+    { "jpg",  "image/jpeg", FLAG_STATIC_RESOURCE                   },
+    { "jpeg", "image/jpeg", FLAG_STATIC_RESOURCE                   },
+    { "tiff", "image/tiff", FLAG_STATIC_RESOURCE                   },
+    { "txt",  "text/plain; charset=utf-8", FLAG_STATIC_RESOURCE    },
+    { "ico",  "image/x-icon", FLAG_STATIC_RESOURCE                 },
+    { "h",    "text/x-c; charset=utf-8", FLAG_STATIC_RESOURCE      },
+    { "c",    "text/x-c; charset=utf-8", FLAG_STATIC_RESOURCE      },
+    { "cxx",  "text/x-xxc; charset=utf-8", FLAG_STATIC_RESOURCE    },
+};
+
+/* content types (prefixes) that are usually not compressed already */
+static const char* compressible[] =
+{
+    "text/",
+    "application/javascript",
+    "application/json",
+    "application/xml",
+    "image/svg+xml",
+    "image/bmp",
+    "image/x-icon",
+};
+
+/* open addressing hash table, an empty extension marks a free slot */
+typedef struct
+{
+    char ext[ MIME_EXT_MAX ];   /* lower case extension */
+    const char* type;           /* content type */
+    int flags;                  /* caching flags (FLAG_*) */
+}
+mime_entry;
+
+static mime_entry* table = NULL;
+static size_t table_size = 0;
+
+/* copy a lower case version of an extension, zero if it cannot be used */
+static int lower_ext( char* out, const char* ext )
+{
+    size_t i;
+
+    for( i = 0; ext[i]; ++i )
+    {
+        if( i >= MIME_EXT_MAX - 1 || ext[i] == '/' )
+            return 0;
+        out[i] = tolower( ext[i] );
+    }
+
+    out[i] = '\0';
+    return i > 0;
+}
+
+/* get the slot holding an extension, or the free slot it would go to */
+static mime_entry* find_slot( const char* ext )
+{
+    unsigned long hash = 2166136261UL;
+    const char* ptr;
+    size_t i;
+
+    for( ptr = ext; *ptr; ++ptr )
+        hash = (hash ^ (unsigned char)*ptr) * 16777619UL;
+
+    i = hash & (table_size - 1);
+
+    while( table[i].ext[0] && strcmp( table[i].ext, ext ) )
+        i = (i + 1) & (table_size - 1);
+
+    return table + i;
+}
+
+int mime_init( void )
+{
+    size_t i, count = sizeof(mimemap) / sizeof(mimemap[0]);
+    char ext[ MIME_EXT_MAX ];
+    const cfg_mime* m;
+    mime_entry* e;
+
+    mime_cleanup( );
+
+    for( m = config_get_mime( ); m; m = m->next )
+        ++count;
+
+    /* keep the table at most half full */
+    for( table_size = 16; table_size < 2 * count; table_size *= 2 ) { }
+
+    if( !(table = calloc( table_size, sizeof(table[0]) )) )
+    {
+        table_size = 0;
+        return 0;
+    }
+
+    for( i = 0; i < sizeof(mimemap) / sizeof(mimemap[0]); ++i )
+    {
+        e = find_slot( mimemap[i].ending );
+        strcpy( e->ext, mimemap[i].ending );
+        e->type = mimemap[i].mime;
+        e->flags = mimemap[i].flags;
+    }
+
+    /* configured types replace built-in ones, but keep their flags */
+    for( m = config_get_mime( ); m; m = m->next )
+    {
+        if( !lower_ext( ext, m->ext ) )
+            continue;
+
+        e = find_slot( ext );
+        if( !e->ext[0] )
+        {
+            strcpy( e->ext, ext );
+            e->flags = FLAG_STATIC_RESOURCE;
+        }
+        e->type = m->type;
+    }
+
+    return 1;
+}
+
+void mime_guess( const char* name, http_file_info* info )
+{
+    char ext[ MIME_EXT_MAX ];
+    mime_entry* e;
+
+    info->type = "application/octet-stream";
+    info->flags = FLAG_STATIC_RESOURCE;
+
+    if( !table || !(name = strrchr( name, '.' )) || !lower_ext( ext, name+1 ) )
+        return;
+
+    e = find_slot( ext );
+
+    if( e->ext[0] )
+    {
+        info->type = e->type;
+        info->flags = e->flags;
+    }
+}
+
+int mime_compressible( const char* type )
+{
+    size_t i;
+
+    for( i = 0; i < sizeof(compressible) / sizeof(compressible[0]); ++i )
+    {
+        if( !strncmp( type, compressible[i], strlen(compressible[i]) ) )
+            return 1;
+    }
+    return 0;
+}
+
+void mime_cleanup( void )
+{
+    free( table );
+    table = NULL;
+    table_size = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include "http.h"
+
+/* maximum length of a file extension in the content type table */
+#define MIME_EXT_MAX 16
+
+/*
+    Compile the table mapping file extensions to content types from the
+    built-in defaults and the [mime] section of the configuration. Has to
+    be called again after reloading the configuration, as the table points
+    into it.
+
+    Returns non-zero on success, zero on failure.
+ */
+int mime_init( void );
+
+/*
+    Set the content type and caching flags of a file info from the
+    extension of a file name. Extensions are matched case insensitively.
+ */
+void mime_guess( const char* name, http_file_info* info );
+
+/* check if content of a given type is worth compressing */
+int mime_compressible( const char* type );
+
+/* free the content type table */
+void mime_cleanup( void );
+
+#endif /* MIME_H */
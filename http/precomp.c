@@ -0,0 +1,246 @@
+#include "precomp.h"
+#include "http.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+
+/* upper limit for the number of files with variants per directory */
+#define PRECOMP_MAX_FILES 65536
+
+/* maximum sub directory nesting that is scanned */
+#define PRECOMP_MAX_DEPTH 32
+
+/* a file with precompressed variants, keyed by directory and path */
+typedef struct precomp_entry
+{
+    struct precomp_entry* next;
+    unsigned long hash;
+    int dirfd;
+    int variants;               /* ENC_* flags */
+    char path[ 1 ];             /* path without the variant suffix */
+}
+precomp_entry;
+
+static precomp_entry** buckets = NULL;
+static size_t num_buckets = 0;
+static size_t num_entries = 0;
+
+/* directories that have been indexed completely */
+static int* dirs = NULL;
+static size_t num_dirs = 0;
+
+static unsigned long hash_key( int dirfd, const char* path )
+{
+    unsigned long hash = 2166136261UL;
+
+    while( *path )
+        hash = (hash ^ (unsigned char)*(path++)) * 16777619UL;
+
+    return hash ^ ((unsigned long)dirfd << 1);
+}
+
+static int grow_table( void )
+{
+    size_t i, count = num_buckets ? num_buckets * 2 : 256;
+    precomp_entry **new, *e;
+
+    if( !(new = calloc( count, sizeof(new[0]) )) )
+        return 0;
+
+    for( i = 0; i < num_buckets; ++i )
+    {
+        while( (e = buckets[i]) )
+        {
+            buckets[i] = e->next;
+            e->next = new[ e->hash & (count - 1) ];
+            new[ e->hash & (count - 1) ] = e;
+        }
+    }
+
+    free( buckets );
+    buckets = new;
+    num_buckets = count;
+    return 1;
+}
+
+static int add_variant( int dirfd, const char* path, int variant,
+                        size_t* count )
+{
+    unsigned long hash = hash_key( dirfd, path );
+    size_t len = strlen( path );
+    precomp_entry* e;
+
+    if( num_buckets )
+    {
+        for( e = buckets[ hash & (num_buckets - 1) ]; e; e = e->next )
+        {
+            if( e->hash == hash && e->dirfd == dirfd &&
+                !strcmp( e->path, path ) )
+            {
+                e->variants |= variant;
+                return 1;
+            }
+        }
+    }
+
+    if( *count >= PRECOMP_MAX_FILES )
+        return 0;
+
+    if( num_entries >= num_buckets && !grow_table( ) )
+        return 0;
+
+    if( !(e = malloc( sizeof(*e) + len )) )
+        return 0;
+
+    e->hash = hash;
+    e->dirfd = dirfd;
+    e->variants = variant;
+    memcpy( e->path, path, len + 1 );
+
+    e->next = buckets[ hash & (num_buckets - 1) ];
+    buckets[ hash & (num_buckets - 1) ] = e;
+    ++num_entries;
+    ++(*count);
+    return 1;
+}
+
+/*
+    Scan a directory opened as fd (which is taken over) with the relative
+    path of it in path[0..len], adding variants found to the index of root.
+ */
+static int scan_dir( int root, int fd, char* path, size_t len, int depth,
+                     size_t* count )
+{
+    struct dirent* ent;
+    struct stat sb;
+    size_t namelen;
+    int type, sub;
+    DIR* dir;
+
+    if( depth > PRECOMP_MAX_DEPTH || !(dir = fdopendir( fd )) )
+    {
+        close( fd );
+        return 0;
+    }
+
+    while( (ent = readdir( dir )) )
+    {
+        if( ent->d_name[0] == '.' && (!ent->d_name[1] ||
+            (ent->d_name[1] == '.' && !ent->d_name[2])) )
+            continue;
+
+        namelen = strlen( ent->d_name );
+        if( len + namelen + 2 > PATH_MAX )
+            continue;
+
+        memcpy( path + len, ent->d_name, namelen + 1 );
+        type = ent->d_type;
+
+        if( type == DT_UNKNOWN )
+        {
+            if( fstatat( fd, ent->d_name, &sb, AT_SYMLINK_NOFOLLOW ) != 0 )
+                continue;
+            type = S_ISDIR(sb.st_mode) ? DT_DIR :
+                   (S_ISLNK(sb.st_mode) ? DT_LNK : DT_REG);
+        }
+
+        if( type == DT_DIR )
+        {
+            sub = openat( fd, ent->d_name,
+                          O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC );
+            if( sub < 0 )
+                continue;
+
+            path[ len + namelen ] = '/';
+            if( !scan_dir( root, sub, path, len + namelen + 1,
+                           depth + 1, count ) )
+                goto fail;
+        }
+        else if( namelen > 3 && !strcmp( ent->d_name + namelen - 3, ".gz" ) )
+        {
+            path[ len + namelen - 3 ] = '\0';
+            if( !add_variant( root, path, ENC_GZIP, count ) )
+                goto fail;
+        }
+    }
+
+    closedir( dir );
+    return 1;
+fail:
+    closedir( dir );
+    return 0;
+}
+
+int precomp_scan( int dirfd )
+{
+    char path[ PATH_MAX ];
+    size_t count = 0;
+    int fd, *new;
+
+    /* the directory stream needs a descriptor of its own */
+    fd = openat( dirfd, ".", O_RDONLY|O_DIRECTORY|O_CLOEXEC );
+    if( fd < 0 )
+        return 0;
+
+    if( !scan_dir( dirfd, fd, path, 0, 0, &count ) )
+        return 0;
+
+    if( !(new = realloc( dirs, (num_dirs + 1) * sizeof(dirs[0]) )) )
+        return 0;
+
+    dirs = new;
+    dirs[ num_dirs++ ] = dirfd;
+    return 1;
+}
+
+int precomp_lookup( int dirfd, const char* path )
+{
+    unsigned long hash;
+    precomp_entry* e;
+    size_t i;
+
+    for( i = 0; i < num_dirs && dirs[i] != dirfd; ++i ) { }
+
+    if( i == num_dirs )
+        return -1;
+
+    if( !num_entries )
+        return 0;
+
+    hash = hash_key( dirfd, path );
+
+    for( e = buckets[ hash & (num_buckets - 1) ]; e; e = e->next )
+    {
+        if( e->hash == hash && e->dirfd == dirfd && !strcmp( e->path, path ) )
+            return e->variants;
+    }
+
+    return 0;
+}
+
+void precomp_cleanup( void )
+{
+    precomp_entry* e;
+    size_t i;
+
+    for( i = 0; i < num_buckets; ++i )
+    {
+        while( (e = buckets[i]) )
+        {
+            buckets[i] = e->next;
+            free( e );
+        }
+    }
+
+    free( buckets );
+    free( dirs );
+    buckets = NULL;
+    dirs = NULL;
+    num_buckets = num_entries = num_dirs = 0;
+}
@@ -0,0 +1,24 @@
+#ifndef PRECOMP_H
+#define PRECOMP_H
+
+/*
+    Scan a static file directory recursively and remember which files
+    have a precompressed variant next to them, e.g. "index.html.gz" for
+    "index.html". Symbolic links to directories are not followed.
+
+    Returns non-zero on success, zero if the directory could not be
+    indexed completely (e.g. too many files), in which case lookups for
+    it report that it is not indexed.
+ */
+int precomp_scan( int dirfd );
+
+/*
+    Get the precompressed variants (ENC_* flags) of a file in a scanned
+    directory. Returns a negative value if the directory is not indexed.
+ */
+int precomp_lookup( int dirfd, const char* path );
+
+/* discard the index of all directories */
+void precomp_cleanup( void );
+
+#endif /* PRECOMP_H */
@@ -8,10 +8,13 @@
 
 #include "config.h"
 #include "rest.h"
+#include "body.h"
 #include "sock.h"
 #include "json.h"
 #include "user.h"
 #include "str.h"
+#include "zstream.h"
+#include "writer.h"
 #include "rdb.h"
 
 
@@ -34,47 +37,63 @@ static int sess_end( sock_t* sock, const cfg_host* h, http_request* req );
 
 
 
+/* content type of data sent by HTML forms */
+#define FORM_TYPE "application/x-www-form-urlencoded"
+
 static const struct
 {
     int method;             /* method to map to, negative value for all */
     const char* path;       /* sub-path of request to map to */
     const char* host;       /* if set, only allow for this requested host */
     const char* accept;     /* content type that is accepted */
+    unsigned long maxbody;  /* largest request body the handler reads */
 
     int(* callback )( sock_t* sock, const cfg_host* h, http_request* req );
 }
 restmap[] =
 {
-    {-1,       "echo",  NULL,NULL,                               echo_demo },
-    {HTTP_GET, "form",  NULL,NULL,                               form_get  },
-    {HTTP_POST,"form",  NULL,"application/x-www-form-urlencoded",form_post },
-    {HTTP_GET, "cookie",NULL,NULL,                               cookie_get},
-    {HTTP_GET, "inf",   NULL,NULL,                               inf_get   },
-    {HTTP_GET, "table", NULL,NULL,                               table_get },
-    {HTTP_GET, "sess",  NULL,NULL,                               sess_get  },
-    {HTTP_POST,"login", NULL,"application/x-www-form-urlencoded",sess_start},
-    {HTTP_GET, "logout",NULL,NULL,                               sess_end  },
+    {-1,       "echo",  NULL,NULL,      0,     echo_demo },
+    {HTTP_GET, "form",  NULL,NULL,      0,     form_get  },
+    {HTTP_POST,"form",  NULL,FORM_TYPE, 65536, form_post },
+    {HTTP_GET, "cookie",NULL,NULL,      0,     cookie_get},
+    {HTTP_GET, "inf",   NULL,NULL,      0,     inf_get   },
+    {HTTP_GET, "table", NULL,NULL,      0,     table_get },
+    {HTTP_GET, "sess",  NULL,NULL,      0,     sess_get  },
+    {HTTP_POST,"login", NULL,FORM_TYPE, 1024,  sess_start},
+    {HTTP_GET, "logout",NULL,NULL,      0,     sess_end  },
 #ifdef JSON_SERIALIZER
-    {HTTP_GET, "json",  NULL,NULL,                               json_get  },
+    {HTTP_GET, "json",  NULL,NULL,      0,     json_get  },
 #endif
-    {-1,       "redir", NULL,NULL,                               redirect  },
+    {-1,       "redir", NULL,NULL,      0,     redirect  },
 };
 
 
 
-int rest_handle_request( sock_t* sock, const cfg_host* h, http_request* req )
+/* strip the REST directory from a path, NULL if it is not underneath */
+static const char* rest_path( const cfg_host* h, const char* path )
 {
-    int error = ERR_NOT_FOUND;
-    size_t i, len;
+    size_t len = strlen(h->restdir);
 
-    len = strlen(h->restdir);
+    if( !path || strncmp(path, h->restdir, len) )
+        return NULL;
+    if( path[len] && path[len]!='/' )
+        return NULL;
+
+    for( path+=len; path[0]=='/'; ++path ) { }
+    return path;
+}
 
-    if( strncmp(req->path, h->restdir, len) )
-        goto out;
-    if( req->path[len] && req->path[len]!='/' )
-        goto out;
+/*
+    Find the entry of the REST map that handles a request for a path
+    below the REST directory. Returns its index, or a negative value and
+    the ERR_* value why none matched.
+ */
+static int find_handler( const http_request* req, const char* path,
+                         int* error )
+{
+    size_t i, len;
 
-    for( req->path+=len; req->path[0]=='/'; ++req->path ) { }
+    *error = ERR_NOT_FOUND;
 
     for( i=0; i<sizeof(restmap)/sizeof(restmap[0]); ++i )
     {
@@ -83,51 +102,114 @@ int rest_handle_request( sock_t* sock, const cfg_host* h, http_request* req )
 
         len = strlen(restmap[i].path);
 
-        if( strncmp(req->path, restmap[i].path, len) )
+        if( strncmp(path, restmap[i].path, len) )
             continue;
 
-        if( req->path[len] && req->path[len]!='/' )
+        if( path[len] && path[len]!='/' )
             continue;
 
-        error = ERR_METHOD;
+        *error = ERR_METHOD;
         if( restmap[i].method>=0 && req->method != restmap[i].method )
             continue;
 
-        error = ERR_TYPE;
+        *error = ERR_TYPE;
         if( restmap[i].accept && !req->type )
             continue;
         if( restmap[i].accept && strcmp(req->type, restmap[i].accept) )
             continue;
 
-        if( req->path[len] )
-            req->path += len + 1;
-
-        return restmap[i].callback( sock, h, req );
+        return i;
     }
-out:
-    return error;
+    return -1;
+}
+
+int rest_handle_request( sock_t* sock, const cfg_host* h, http_request* req )
+{
+    const char* path;
+    int error, i;
+    size_t len;
+
+    if( !(path = rest_path( h, req->path )) )
+        return ERR_NOT_FOUND;
+
+    if( (i = find_handler( req, path, &error )) < 0 )
+        return error;
+
+    len = strlen(restmap[i].path);
+    req->path = path[len] ? path + len + 1 : path;
+
+    req->body->limit = restmap[i].maxbody;
+    return restmap[i].callback( sock, h, req );
+}
+
+unsigned long rest_max_body( const cfg_host* h, const http_request* req )
+{
+    const char* path;
+    int error, i;
+
+    if( !(path = rest_path( h, req->path )) )
+        return 0;
+
+    i = find_handler( req, path, &error );
+    return i < 0 ? 0 : restmap[i].maxbody;
 }
 
-static void send_page_buffer( string* page, int fd, const http_request* req,
-                              const char* setcookies )
+/*
+    Send a generated page. If the handler can tell that the same page was
+    generated before, it can pass an entity tag so that clients can
+    revalidate their copy instead of fetching it again. Like for static
+    files, a compressed page gets a tag of its own, derived from that one.
+ */
+static void send_page_buffer( string* page, sock_t* sock,
+                              const http_request* req,
+                              const char* setcookies, const char* etag )
 {
+    char tag[ HTTP_ETAG_LENGTH ];
     http_file_info info;
+    int encoding;
+    size_t len;
 
     memset( &info, 0, sizeof(info) );
+    info.last_mod = time(0);
+    info.flags = etag ? 0 : FLAG_DYNAMIC;
+    info.setcookies = setcookies;
+    info.type = "text/html; charset=utf-8";
+
+    encoding = zstream_choose( req->accept, info.type, page->used );
+
+    if( zstream_choose( ENC_DEFLATE | ENC_GZIP, info.type, page->used ) )
+        info.flags |= FLAG_VARY;
+
+    /* the encoding is decided up front, so the right tag is compared */
+    len = etag ? strlen( etag ) : 0;
 
-    if( req->accept & (ENC_DEFLATE|ENC_GZIP) )
+    if( encoding && len >= 2 && len + 3 < sizeof(tag) )
     {
-        if( string_compress( page, !(req->accept & ENC_DEFLATE) ) )
-            info.encoding = (req->accept & ENC_DEFLATE) ? "deflate" : "gzip";
+        memcpy( tag, etag, len - 1 );
+        strcpy( tag + len - 1,
+                encoding == ENC_DEFLATE ? "-df\"" : "-gz\"" );
+        info.etag = tag;
+    }
+    else if( !encoding )
+    {
+        info.etag = etag;
     }
 
-    info.last_mod = time(0);
-    info.type = "text/html; charset=utf-8";
+    /* the page is generated now, so only the tag can tell it is the same */
+    if( info.etag && req->ifnomatch && http_is_unchanged( req, &info ) )
+    {
+        info.status = ERR_UNCHANGED;
+        http_response_header( sock, &info );
+        return;
+    }
+
+    if( encoding && zstream_compress( page, encoding, info.type ) )
+        info.encoding = encoding == ENC_DEFLATE ? "deflate" : "gzip";
+    else
+        info.etag = etag;
+
     info.size = page->used;
-    info.flags = FLAG_DYNAMIC;
-    info.setcookies = setcookies;
-    http_response_header( fd, &info );
-    write( fd, page->data, page->used );
+    http_send_response( sock, &info, page->data, page->used );
 }
 
 /****************************************************************************/
@@ -168,7 +250,7 @@ static int echo_demo( sock_t* sock, const cfg_host* h, http_request* req )
     file = openat( h->tpldir, "echo.tpl", O_RDONLY );
     if( file<0 )
         return ERR_INTERNAL;
-    string_init( &page );
+    string_init_arena( &page, req->mem );
 
     len = sizeof(echo_attr)/sizeof(echo_attr[0]);
 
@@ -188,7 +270,7 @@ static int echo_demo( sock_t* sock, const cfg_host* h, http_request* req )
 
     close( file );
 
-    send_page_buffer( &page, sock->fd, req, NULL );
+    send_page_buffer( &page, sock, req, NULL, NULL );
     string_cleanup( &page );
     return 0;
 }
@@ -206,7 +288,7 @@ static int form_get( sock_t* sock, const cfg_host* h, http_request* req )
     file = openat( h->tpldir, "form.tpl", O_RDONLY );
     if( file<0 )
         return ERR_INTERNAL;
-    string_init( &page );
+    string_init_arena( &page, req->mem );
 
     len = sizeof(echo_attr)/sizeof(echo_attr[0]);
 
@@ -224,7 +306,7 @@ static int form_get( sock_t* sock, const cfg_host* h, http_request* req )
     }
 
     close( file );
-    send_page_buffer( &page, sock->fd, req, NULL );
+    send_page_buffer( &page, sock, req, NULL, NULL );
     string_cleanup( &page );
     return 0;
 }
@@ -232,26 +314,31 @@ static int form_get( sock_t* sock, const cfg_host* h, http_request* req )
 static int form_post( sock_t* sock, const cfg_host* h, http_request* req )
 {
     const char *first, *second;
-    char buffer[128];
     int ret, file;
-    string page;
+    string args, page;
     size_t len;
     int count;
 
-    if( req->length > (sizeof(buffer)-1) )
-        return ERR_SIZE;
+    if( !string_init_arena( &args, req->mem ) )
+        return ERR_INTERNAL;
 
-    sock_read( sock, buffer, req->length, 0 );
-    buffer[ req->length ] = '\0';
+    if( (ret = body_read_all( req->body, &args )) != 0 )
+    {
+        string_cleanup( &args );
+        return ret;
+    }
 
-    count = http_split_args( buffer );
-    first = http_get_arg( buffer, count, "str1" );
-    second = http_get_arg( buffer, count, "str2" );
+    count = http_split_args( args.data );
+    first = http_get_arg( args.data, count, "str1" );
+    second = http_get_arg( args.data, count, "str2" );
 
     file = openat( h->tpldir, "form.tpl", O_RDONLY );
     if( file<0 )
+    {
+        string_cleanup( &args );
         return ERR_INTERNAL;
-    string_init( &page );
+    }
+    string_init_arena( &page, req->mem );
 
     len = sizeof(echo_attr)/sizeof(echo_attr[0]);
 
@@ -264,13 +351,15 @@ static int form_post( sock_t* sock, const cfg_host* h, http_request* req )
         default:
             close( file );
             string_cleanup( &page );
+            string_cleanup( &args );
             return ERR_INTERNAL;
         }
     }
 
     close( file );
-    send_page_buffer( &page, sock->fd, req, NULL );
+    send_page_buffer( &page, sock, req, NULL, NULL );
     string_cleanup( &page );
+    string_cleanup( &args );
     return 0;
 }
 
@@ -297,7 +386,7 @@ static int cookie_get( sock_t* sock, const cfg_host* h, http_request* req )
     if( getarg )
         sprintf( cookiebuffer, "magic=%s", getarg );
 
-    string_init( &page );
+    string_init_arena( &page, req->mem );
     len = sizeof(echo_attr)/sizeof(echo_attr[0]);
 
     while( (ret = string_process_template( &page, file, echo_attr, len ))!=0 )
@@ -314,7 +403,8 @@ static int cookie_get( sock_t* sock, const cfg_host* h, http_request* req )
     }
 
     close( file );
-    send_page_buffer( &page, sock->fd, req, getarg ? cookiebuffer : NULL );
+    send_page_buffer( &page, sock, req,
+                      getarg ? cookiebuffer : NULL, NULL );
     string_cleanup( &page );
     return 0;
 }
@@ -331,19 +421,28 @@ static int table_get( sock_t* sock, const cfg_host* h, http_request* req )
     char buffer[ sizeof(db_msg) + sizeof(db_object) ];
     db_msg* msg = (db_msg*)buffer;
     db_object* obj = (db_object*)msg->payload;
-    string page;
+    http_file_info info;
+    writer page;
     int db;
     (void)h;
 
-    string_init( &page );
-    string_append( &page, "<html><head><title>Database</title></head>" );
-    string_append( &page, "<body><h1>Database Tabe</h1>" );
+    /* the table can be arbitrarily large, so rows are sent as they come */
+    memset( &info, 0, sizeof(info) );
+    info.last_mod = time(0);
+    info.flags = FLAG_DYNAMIC;
+    info.type = "text/html; charset=utf-8";
+
+    if( !writer_begin( &page, sock, req, &info ) )
+        return ERR_INTERNAL;
+
+    writer_puts( &page, "<html><head><title>Database</title></head>" );
+    writer_puts( &page, "<body><h1>Database Tabe</h1>" );
 
     db = connect_to( "/tmp/rdb", 0, AF_UNIX );
 
     if( db<0 )
     {
-        string_append( &page, "<b>Connection Failed</b><br>" );
+        writer_puts( &page, "<b>Connection Failed</b><br>" );
     }
     else
     {
@@ -351,49 +450,44 @@ static int table_get( sock_t* sock, const cfg_host* h, http_request* req )
         msg->length = 0;
         write( db, msg, sizeof(*msg) );
 
-        string_append( &page, "<table>\n<tr><th>Name</th><th>Color</th>"
-                              "<th>Value</th></tr>\n" );
+        writer_puts( &page, "<table>\n<tr><th>Name</th><th>Color</th>"
+                            "<th>Value</th></tr>\n" );
 
         while( read( db, buffer, sizeof(buffer) ) == sizeof(buffer) )
         {
             if( msg->type != DB_OBJECT || msg->length != sizeof(*obj) )
                 break;
 
-            string_append( &page, "<tr><td>" );
-            string_append( &page, obj->name );
-            string_append( &page, "</td><td>" );
-            string_append( &page, obj->color );
-            string_append( &page, "</td><td>" );
+            writer_puts( &page, "<tr><td>" );
+            writer_puts( &page, obj->name );
+            writer_puts( &page, "</td><td>" );
+            writer_puts( &page, obj->color );
+            writer_puts( &page, "</td><td>" );
             sprintf( buffer, "%ld", obj->value );
-            string_append( &page, buffer );
-            string_append( &page, "</td></tr>\n" );
+            writer_puts( &page, buffer );
+
+            /* no point in asking for more if the client is gone */
+            if( !writer_puts( &page, "</td></tr>\n" ) )
+                break;
         }
 
-        string_append( &page, "</table>\n" );
+        writer_puts( &page, "</table>\n" );
         close( db );
     }
 
-    string_append( &page, "</body></html>" );
+    writer_puts( &page, "</body></html>" );
 
-    send_page_buffer( &page, sock->fd, req, NULL );
-    string_cleanup( &page );
+    /* a response that broke off cannot be followed by another one */
+    if( !writer_end( &page ) )
+        req->flags |= REQ_CLOSE;
     return 0;
 }
 
 static int redirect( sock_t* sock, const cfg_host* h, http_request* req )
 {
-    http_file_info info;
-    string page;
-    int ret;
     (void)h;
-    ret = gen_default_page(&page, &info, ERR_REDIRECT_GET,
-                           req->accept, "/Lenna.png");
-    if( !ret )
-        return ERR_INTERNAL;
-
-    http_response_header( sock->fd, &info );
-    write( sock->fd, page.data, page.used );
-    string_cleanup( &page );
+    http_send_redirect( sock, ERR_REDIRECT_GET, req->accept,
+                        "/Lenna.png" );
     return 0;
 }
 
@@ -411,7 +505,7 @@ static int sess_get( sock_t* sock, const cfg_host* h, http_request* req )
 
     sid = user_get_session_cookie( req );
 
-    string_init( &page );
+    string_init_arena( &page, req->mem );
     string_append( &page, "<html><head><title>Session</title></head>\n" );
     string_append( &page, "<body><h1>Session Management</h1>\n" );
 
@@ -476,7 +570,7 @@ static int sess_get( sock_t* sock, const cfg_host* h, http_request* req )
 out:
     close( db );
     string_append( &page, "</body></html>" );
-    send_page_buffer( &page, sock->fd, req, NULL );
+    send_page_buffer( &page, sock, req, NULL, NULL );
     string_cleanup( &page );
     return 0;
 fail:
@@ -486,34 +580,43 @@ fail:
 
 static int sess_start( sock_t* sock, const cfg_host* h, http_request* req )
 {
+    const char *key, *uidstr = NULL;
     db_session_data data;
-    const char* uidstr;
-    int count, db, ret;
     char buffer[128];
-    uint32_t uid;
+    uint32_t uid = 0;
+    int db, ret;
     string page;
     db_msg msg;
     char* end;
     (void)h;
 
-    string_init( &page );
-    string_append( &page, "<html><head><title>Login</title></head><body>" );
-    string_append( &page, "<h1>Login</h1>\n" );
+    /* get UID, the buffer is reused for the cookie later on */
+    while( (ret = body_next_arg( req->body, buffer, sizeof(buffer),
+                                 &key, &uidstr )) > 0 )
+    {
+        if( !strcmp( key, "uid" ) )
+            break;
+    }
 
-    /* get UID */
-    if( req->length > (sizeof(buffer)-1) )
-        return ERR_SIZE;
+    if( ret < 0 )
+        return req->body->error;
 
-    sock_read( sock, buffer, req->length, 0 );
-    buffer[ req->length ] = '\0';
+    if( ret > 0 && isdigit(*uidstr) )
+    {
+        uid = strtol( uidstr, &end, 10 );
+        if( *end )
+            uidstr = NULL;
+    }
+    else
+    {
+        uidstr = NULL;
+    }
 
-    count = http_split_args( buffer );
-    uidstr = http_get_arg( buffer, count, "uid" );
-    if( !uidstr || !isdigit(*uidstr) )
-        goto nouid;
+    string_init_arena( &page, req->mem );
+    string_append( &page, "<html><head><title>Login</title></head><body>" );
+    string_append( &page, "<h1>Login</h1>\n" );
 
-    uid = strtol( uidstr, &end, 10 );
-    if( !end || *end )
+    if( !uidstr )
         goto nouid;
 
     /* create session */
@@ -534,13 +637,13 @@ static int sess_start( sock_t* sock, const cfg_host* h, http_request* req )
     close( db );
 
     user_print_session_cookie( buffer, sizeof(buffer), data.sid );
-    send_page_buffer( &page, sock->fd, req, buffer );
+    send_page_buffer( &page, sock, req, buffer, NULL );
     string_cleanup( &page );
     return 0;
 dberr:
     string_append( &page, "Database Error!" );
     string_append( &page, "</body></html>" );
-    send_page_buffer( &page, sock->fd, req, NULL );
+    send_page_buffer( &page, sock, req, NULL, NULL );
     string_cleanup( &page );
 
     if( db >= 0 )
@@ -554,7 +657,7 @@ dberr:
 nouid:
     string_append( &page, "Error: UID must be a positive number!" );
     string_append( &page, "</body></html>" );
-    send_page_buffer( &page, sock->fd, req, NULL );
+    send_page_buffer( &page, sock, req, NULL, NULL );
     string_cleanup( &page );
     return 0;
 }
@@ -585,11 +688,11 @@ static int sess_end( sock_t* sock, const cfg_host* h, http_request* req )
 
     user_print_session_cookie( buffer, sizeof(buffer), 0 );
 
-    string_init( &page );
+    string_init_arena( &page, req->mem );
     string_append(&page, "<html><head><title>Logout</title></head><body>"  );
     string_append(&page, "<h1>Logout</h1>You have been logged out.<br>\n"  );
     string_append(&page, "<a href=\"/rest/sess\">go back</a></body></html>");
-    send_page_buffer( &page, sock->fd, req, buffer );
+    send_page_buffer( &page, sock, req, buffer, NULL );
     string_cleanup( &page );
     return 0;
 }
@@ -618,10 +721,9 @@ static int json_get( sock_t* sock, const cfg_host* h, http_request* req )
 {
     node_t a, b, c;
     string str;
-    (void)req;
     (void)h;
 
-    if( !string_init( &str ) )
+    if( !string_init_arena( &str, req->mem ) )
         return ERR_INTERNAL;
 
     a.left = &b;
@@ -646,7 +748,8 @@ static int json_get( sock_t* sock, const cfg_host* h, http_request* req )
         return ERR_INTERNAL;
     }
 
-    send_page_buffer( &str, sock->fd, req, NULL );
+    /* the demo data never changes */
+    send_page_buffer( &str, sock, req, NULL, "\"json-demo-1\"" );
     string_cleanup( &str );
     return 0;
 }
@@ -11,5 +11,11 @@
  */
 int rest_handle_request( sock_t* sock, const cfg_host* h, http_request* req );
 
+/*
+    Get the size limit for the body of a request that the handler it is
+    routed to accepts, zero if there is no such handler.
+ */
+unsigned long rest_max_body( const cfg_host* h, const http_request* req );
+
 #endif /* REST_H */
 
@@ -0,0 +1,114 @@
+#include "scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #include <immintrin.h>
+    #define HAVE_SIMD_SCAN
+#endif
+
+#define IS_SPECIAL( c, prev ) \
+    ((unsigned char)(c) < 0x20 || (c) == '\\' || \
+     ((c) == ' ' && (prev) == ' ') || ((c) == '/' && (prev) == '/'))
+
+static size_t scan_scalar( const char* str, size_t size )
+{
+    size_t i;
+
+    for( i = 0; i < size; ++i )
+    {
+        if( IS_SPECIAL( str[i], str[i - 1] ) )
+            break;
+    }
+    return i;
+}
+
+#ifdef HAVE_SIMD_SCAN
+__attribute__((target("sse2")))
+static size_t scan_sse2( const char* str, size_t size )
+{
+    const __m128i ctl = _mm_set1_epi8( 0x1F );
+    const __m128i bs = _mm_set1_epi8( '\\' );
+    const __m128i sp = _mm_set1_epi8( ' ' );
+    const __m128i sl = _mm_set1_epi8( '/' );
+    __m128i c, p, m;
+    size_t i;
+    int mask;
+
+    for( i = 0; i + 16 <= size; i += 16 )
+    {
+        c = _mm_loadu_si128( (const __m128i*)(str + i) );
+        p = _mm_loadu_si128( (const __m128i*)(str + i - 1) );
+
+        m = _mm_cmpeq_epi8( _mm_min_epu8( c, ctl ), c );
+        m = _mm_or_si128( m, _mm_cmpeq_epi8( c, bs ) );
+        m = _mm_or_si128( m, _mm_and_si128( _mm_cmpeq_epi8( c, sp ),
+                                            _mm_cmpeq_epi8( p, sp ) ) );
+        m = _mm_or_si128( m, _mm_and_si128( _mm_cmpeq_epi8( c, sl ),
+                                            _mm_cmpeq_epi8( p, sl ) ) );
+
+        if( (mask = _mm_movemask_epi8( m )) != 0 )
+            return i + __builtin_ctz( mask );
+    }
+
+    return i + scan_scalar( str + i, size - i );
+}
+
+__attribute__((target("avx2")))
+static size_t scan_avx2( const char* str, size_t size )
+{
+    const __m256i ctl = _mm256_set1_epi8( 0x1F );
+    const __m256i bs = _mm256_set1_epi8( '\\' );
+    const __m256i sp = _mm256_set1_epi8( ' ' );
+    const __m256i sl = _mm256_set1_epi8( '/' );
+    __m256i c, p, m;
+    unsigned int mask;
+    size_t i;
+
+    for( i = 0; i + 32 <= size; i += 32 )
+    {
+        c = _mm256_loadu_si256( (const __m256i*)(str + i) );
+        p = _mm256_loadu_si256( (const __m256i*)(str + i - 1) );
+
+        m = _mm256_cmpeq_epi8( _mm256_min_epu8( c, ctl ), c );
+        m = _mm256_or_si256( m, _mm256_cmpeq_epi8( c, bs ) );
+        m = _mm256_or_si256( m,
+                _mm256_and_si256( _mm256_cmpeq_epi8( c, sp ),
+                                  _mm256_cmpeq_epi8( p, sp ) ) );
+        m = _mm256_or_si256( m,
+                _mm256_and_si256( _mm256_cmpeq_epi8( c, sl ),
+                                  _mm256_cmpeq_epi8( p, sl ) ) );
+
+        if( (mask = _mm256_movemask_epi8( m )) != 0 )
+            return i + __builtin_ctz( mask );
+    }
+
+    return i + scan_sse2( str + i, size - i );
+}
+#endif
+
+static size_t scan_resolve( const char* str, size_t size );
+
+static size_t (*scan_impl)( const char*, size_t ) = scan_resolve;
+
+/* pick an implementation on first use */
+static size_t scan_resolve( const char* str, size_t size )
+{
+#ifdef HAVE_SIMD_SCAN
+    __builtin_cpu_init( );
+
+    if( __builtin_cpu_supports( "avx2" ) )
+        scan_impl = scan_avx2;
+    else if( __builtin_cpu_supports( "sse2" ) )
+        scan_impl = scan_sse2;
+    else
+#endif
+        scan_impl = scan_scalar;
+
+    return scan_impl( str, size );
+}
+
+/****************************************************************************/
+
+size_t http_scan_plain( const char* str, size_t size )
+{
+    return scan_impl( str, size );
+}
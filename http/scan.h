@@ -0,0 +1,19 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+/*
+    Count the bytes at the start of a string that a request header line
+    can keep as they are, i.e. up to the first control character,
+    backslash, repeated space or repeated slash.
+
+    The byte in front of the string is looked at as well (to detect
+    repetitions) and must be readable.
+
+    On x86, an SSE2 or AVX2 implementation is selected at run time,
+    depending on what the CPU supports.
+ */
+size_t http_scan_plain( const char* str, size_t size );
+
+#endif /* SCAN_H */
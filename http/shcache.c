@@ -0,0 +1,244 @@
+#include "shcache.h"
+#include "sock.h"
+
+#include <sys/mman.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+/*
+    The segment is an array of fixed size slots. A file can be stored in
+    one of two slots, selected by the hash of its key.
+
+    The lock field of a slot is zero if the slot is empty, negative while
+    a writer fills it and one plus the number of readers if it holds a
+    valid entry. Readers atomically increment it if it is positive, a
+    writer can only take over a slot that is empty or has no readers.
+    If a worker dies while holding a slot, the slot stays unusable until
+    the segment is recreated.
+ */
+struct shcache_entry
+{
+    int lock;                   /* see above */
+    int dirfd;                  /* directory the path is relative to */
+    int gzip;                   /* non-zero if the client accepted gzip */
+    long expires;               /* monotonic time in seconds to drop it */
+    unsigned long hash;         /* hash value of the key */
+    http_file_info info;        /* response header info for the file */
+    size_t hdrsize;             /* size of the header in data */
+    size_t date;                /* offset of the Date value in data */
+    char path[ SHCACHE_PATH_MAX ];
+    char etag[ HTTP_ETAG_LENGTH ];  /* info.etag points here if set */
+    char data[ 1 ];             /* pre-rendered header + content */
+};
+
+static char* segment = NULL;
+static size_t segment_size = 0;
+static size_t slot_size = 0;
+static size_t num_slots = 0;
+
+static long get_time_sec( void )
+{
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec;
+}
+
+static unsigned long hash_key( int dirfd, const char* path, int gzip )
+{
+    unsigned long hash = 2166136261UL;
+
+    while( *path )
+        hash = (hash ^ (unsigned char)*(path++)) * 16777619UL;
+
+    return hash ^ ((unsigned long)dirfd << 1) ^ (gzip ? 1 : 0);
+}
+
+static shcache_entry* get_slot( unsigned long hash, int i )
+{
+    return (shcache_entry*)(segment + ((hash + i) % num_slots) * slot_size);
+}
+
+/* get exclusive access to one of the slots a key can be stored in */
+static shcache_entry* claim_slot( unsigned long hash )
+{
+    int i, state, expected, first;
+    shcache_entry* e;
+
+    /* when replacing, prefer the slot that held the same key */
+    first = get_slot( hash, 1 )->hash == hash ? 1 : 0;
+
+    /* prefer an empty slot, otherwise replace one without readers */
+    for( state = 0; state <= 1; ++state )
+    {
+        for( i = 0; i < 2; ++i )
+        {
+            e = get_slot( hash, i ^ first );
+            expected = state;
+
+            if( __atomic_compare_exchange_n( &e->lock, &expected, -1, 0,
+                                             __ATOMIC_ACQUIRE,
+                                             __ATOMIC_RELAXED ) )
+            {
+                return e;
+            }
+        }
+    }
+    return NULL;
+}
+
+/****************************************************************************/
+
+int shcache_init( size_t size, size_t max_size )
+{
+    slot_size = sizeof(shcache_entry) + max_size + 1024;
+    slot_size = (slot_size + 63) & ~((size_t)63);
+    num_slots = size / slot_size;
+
+    if( num_slots < 2 )
+        return 0;
+
+    segment_size = num_slots * slot_size;
+    segment = mmap( NULL, segment_size, PROT_READ|PROT_WRITE,
+                    MAP_SHARED|MAP_ANONYMOUS, -1, 0 );
+
+    if( segment == MAP_FAILED )
+    {
+        segment = NULL;
+        num_slots = 0;
+        return 0;
+    }
+    return 1;
+}
+
+void shcache_cleanup( void )
+{
+    if( segment )
+        munmap( segment, segment_size );
+
+    segment = NULL;
+    segment_size = 0;
+    num_slots = 0;
+}
+
+const shcache_entry* shcache_acquire( int dirfd, int gzip, const char* path )
+{
+    unsigned long hash;
+    shcache_entry* e;
+    int i, val;
+
+    if( !segment )
+        return NULL;
+
+    hash = hash_key( dirfd, path, gzip );
+
+    for( i = 0; i < 2; ++i )
+    {
+        e = get_slot( hash, i );
+        val = __atomic_load_n( &e->lock, __ATOMIC_ACQUIRE );
+
+        while( val > 0 && !__atomic_compare_exchange_n( &e->lock, &val,
+                                                        val + 1, 0,
+                                                        __ATOMIC_ACQUIRE,
+                                                        __ATOMIC_ACQUIRE ) )
+        {
+        }
+
+        if( val <= 0 )
+            continue;
+
+        if( e->hash == hash && e->dirfd == dirfd && e->gzip == gzip &&
+            e->expires > get_time_sec( ) && !strcmp( e->path, path ) )
+        {
+            return e;
+        }
+
+        shcache_release( e );
+    }
+
+    return NULL;
+}
+
+void shcache_release( const shcache_entry* e )
+{
+    __atomic_fetch_sub( &((shcache_entry*)e)->lock, 1, __ATOMIC_RELEASE );
+}
+
+const http_file_info* shcache_info( const shcache_entry* e )
+{
+    return &e->info;
+}
+
+const char* shcache_body( const shcache_entry* e )
+{
+    return e->data + e->hdrsize;
+}
+
+void shcache_send( sock_t* sock, const shcache_entry* e, int withbody )
+{
+    struct iovec iov[3];
+
+    iov[0].iov_base = (void*)e->data;
+    iov[0].iov_len = e->date;
+    iov[1].iov_base = (void*)http_current_date( );
+    iov[1].iov_len = HTTP_DATE_LENGTH;
+    iov[2].iov_base = (void*)(e->data + e->date + HTTP_DATE_LENGTH);
+    iov[2].iov_len = e->hdrsize - e->date - HTTP_DATE_LENGTH;
+
+    if( withbody )
+        iov[2].iov_len += e->info.size;
+
+    sock_send_iov( sock, iov, 3 );
+}
+
+int shcache_store( int dirfd, int gzip, const char* path, long ttl,
+                   const http_file_info* info, int fd )
+{
+    size_t hdrsize, len = strlen( path );
+    unsigned long hash;
+    shcache_entry* e;
+    ssize_t ret;
+
+    if( !segment || len >= SHCACHE_PATH_MAX )
+        return 0;
+
+    if( info->etag && strlen( info->etag ) >= HTTP_ETAG_LENGTH )
+        return 0;
+
+    hdrsize = http_render_header( NULL, 0, info, NULL );
+    if( sizeof(shcache_entry) + hdrsize + info->size > slot_size )
+        return 0;
+
+    hash = hash_key( dirfd, path, gzip );
+
+    if( !(e = claim_slot( hash )) )
+        return 0;
+
+    e->dirfd = dirfd;
+    e->gzip = gzip;
+    e->hash = hash;
+    e->info = *info;
+    e->expires = get_time_sec( ) + ttl;
+
+    /* the segment is mapped at the same address in all workers */
+    if( info->etag )
+    {
+        strcpy( e->etag, info->etag );
+        e->info.etag = e->etag;
+    }
+
+    memcpy( e->path, path, len + 1 );
+
+    e->hdrsize = http_render_header( e->data, hdrsize, info, &e->date );
+
+    ret = pread( fd, e->data + hdrsize, info->size, 0 );
+    if( ret < 0 || (size_t)ret != info->size )
+    {
+        __atomic_store_n( &e->lock, 0, __ATOMIC_RELEASE );
+        return 0;
+    }
+
+    __atomic_store_n( &e->lock, 1, __ATOMIC_RELEASE );
+    return 1;
+}
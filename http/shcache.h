@@ -0,0 +1,62 @@
+#ifndef SHCACHE_H
+#define SHCACHE_H
+
+#include <stddef.h>
+
+#include "http.h"
+
+/* maximum length of a path that can be stored in the shared cache */
+#define SHCACHE_PATH_MAX 256
+
+typedef struct shcache_entry shcache_entry;
+
+/*
+    Create the shared file cache segment with a total size in bytes. Must
+    be called before forking the workers, so they all share the same
+    segment. Files up to max_size bytes can be stored in it.
+
+    Returns non-zero on success, zero on failure.
+ */
+int shcache_init( size_t size, size_t max_size );
+
+/* unmap the shared file cache segment of the calling process */
+void shcache_cleanup( void );
+
+/*
+    Look up a file in the shared cache, keyed by directory, path and
+    whether gzip is accepted. Entries whose TTL ran out are not returned.
+
+    If an entry is found, it cannot be replaced until shcache_release is
+    called. Readers never wait for each other or for writers.
+ */
+const shcache_entry* shcache_acquire( int dirfd, int gzip, const char* path );
+
+/* release an entry returned by shcache_acquire */
+void shcache_release( const shcache_entry* e );
+
+/* get the response header info of a shared cache entry */
+const http_file_info* shcache_info( const shcache_entry* e );
+
+/* get the file content stored in a shared cache entry */
+const char* shcache_body( const shcache_entry* e );
+
+/*
+    Send the pre-rendered response of a shared cache entry with an up to
+    date Date field, optionally followed by the file content.
+ */
+void shcache_send( sock_t* sock, const shcache_entry* e, int withbody );
+
+/*
+    Store a file in the shared cache, reading the content from an open
+    file descriptor. Nothing is stored if the file is too large, the path
+    too long or the slots it could go to are in use.
+
+    The info is copied, the strings it points to have to be valid in all
+    workers, i.e. set up before forking them.
+
+    Returns non-zero on success, zero if nothing was stored.
+ */
+int shcache_store( int dirfd, int gzip, const char* path, long ttl,
+                   const http_file_info* info, int fd );
+
+#endif /* SHCACHE_H */
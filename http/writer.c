@@ -0,0 +1,174 @@
+#include "writer.h"
+#include "conf.h"
+#include "sock.h"
+
+#include <stdio.h>
+
+static int send_chunk( writer* w, int last )
+{
+    static const char end[] = "\r\n0\r\n\r\n";
+    char prefix[ 24 ];
+    struct iovec iov[3];
+    int count = 0;
+
+    if( w->out.used )
+    {
+        count = 3;
+        iov[0].iov_base = prefix;
+        iov[0].iov_len = sprintf( prefix, "%lx\r\n",
+                                  (unsigned long)w->out.used );
+        iov[1].iov_base = w->out.data;
+        iov[1].iov_len = w->out.used;
+        iov[2].iov_base = (char*)end;
+        iov[2].iov_len = last ? 7 : 2;
+    }
+    else if( last )
+    {
+        count = 1;
+        iov[0].iov_base = (char*)end + 2;
+        iov[0].iov_len = 5;
+    }
+
+    if( !w->sent )
+    {
+        w->info.flags |= FLAG_CHUNKED;
+        w->sent = 1;
+
+        if( !http_send_response_iov( w->sock, &w->info, iov, count ) )
+            return 0;
+    }
+    else if( count && !sock_send_iov( w->sock, iov, count ) )
+    {
+        return 0;
+    }
+
+    w->out.used = 0;
+    return 1;
+}
+
+/* switch to compressed output, compressing what was buffered so far */
+static int start_compressing( writer* w )
+{
+    string packed;
+
+    if( !string_init_arena( &packed, w->out.mem ) )
+        return 0;
+
+    if( !zstream_begin( &w->z, w->encoding, w->info.type, &packed ) ||
+        !zstream_write( &w->z, w->out.data, w->out.used, 0, &packed ) )
+    {
+        string_cleanup( &packed );
+        return 0;
+    }
+
+    string_cleanup( &w->out );
+    string_move( &w->out, &packed );
+    w->compressing = 1;
+    w->info.encoding = w->encoding == ENC_DEFLATE ? "deflate" : "gzip";
+    return 1;
+}
+
+int writer_begin( writer* w, sock_t* sock, const http_request* req,
+                  const http_file_info* info )
+{
+    memset( w, 0, sizeof(*w) );
+    w->sock = sock;
+    w->chunked = !(req->flags & REQ_HTTP10);
+    w->encoding = zstream_choose( req->accept, info->type, 0 );
+    w->info = *info;
+    w->info.encoding = NULL;
+    w->info.size = 0;
+
+    if( zstream_choose( ENC_DEFLATE | ENC_GZIP, info->type, 0 ) )
+        w->info.flags |= FLAG_VARY;
+
+    if( !string_init_arena( &w->out, req->mem ) )
+    {
+        w->failed = 1;
+        return 0;
+    }
+    return 1;
+}
+
+int writer_append( writer* w, const char* data, size_t size )
+{
+    if( w->failed )
+        return 0;
+
+    if( w->compressing )
+    {
+        if( !zstream_write( &w->z, data, size, 0, &w->out ) )
+            goto fail;
+    }
+    else
+    {
+        if( !string_append_len( &w->out, data, size ) )
+            goto fail;
+
+        if( w->encoding &&
+            w->out.used >= (size_t)config_get_compress( )->min_size &&
+            !start_compressing( w ) )
+        {
+            goto fail;
+        }
+    }
+
+    if( w->chunked && w->out.used >= WRITER_CHUNK && !send_chunk( w, 0 ) )
+        goto fail;
+
+    return 1;
+fail:
+    w->failed = 1;
+    return 0;
+}
+
+int writer_flush( writer* w )
+{
+    if( w->failed )
+        return 0;
+
+    if( !w->chunked )
+        return 1;
+
+    if( w->compressing && !zstream_write( &w->z, NULL, 0, 1, &w->out ) )
+        goto fail;
+
+    if( !send_chunk( w, 0 ) )
+        goto fail;
+
+    return 1;
+fail:
+    w->failed = 1;
+    return 0;
+}
+
+int writer_end( writer* w )
+{
+    if( w->failed )
+        goto out;
+
+    if( w->compressing && !zstream_finish( &w->z, &w->out ) )
+        goto fail;
+
+    if( w->sent )
+    {
+        if( !send_chunk( w, 1 ) )
+            goto fail;
+    }
+    else
+    {
+        w->info.size = w->out.used;
+
+        if( !http_send_response( w->sock, &w->info, w->out.data,
+                                 w->out.used ) )
+        {
+            goto fail;
+        }
+    }
+    goto out;
+fail:
+    w->failed = 1;
+out:
+    string_cleanup( &w->out );
+    return !w->failed;
+}
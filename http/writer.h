@@ -0,0 +1,62 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include "http.h"
+#include "zstream.h"
+#include "str.h"
+
+/* amount of buffered output that is sent as a chunk right away */
+#define WRITER_CHUNK 16384
+
+/*
+    Writes a response body whose size is not known in advance. Output is
+    buffered and, once enough has been collected, sent with chunked
+    transfer encoding. A body that is finished before that is sent in one
+    piece with a Content-Length, like any other response. If the client
+    accepts it, the body is compressed on the fly once it has reached the
+    minimum size for compression.
+ */
+typedef struct
+{
+    sock_t* sock;           /* socket to write to */
+    int chunked;            /* non-zero if chunked encoding can be used */
+    int encoding;           /* encoding to use, once the body is big enough */
+    int compressing;        /* non-zero if output goes through z */
+    int sent;               /* non-zero if the header has been sent */
+    int failed;             /* non-zero if anything went wrong */
+    http_file_info info;    /* header of the response */
+    zstream z;              /* compressor state, if compressing */
+    string out;             /* output not sent yet */
+}
+writer;
+
+/*
+    Start a response with the given header information. The size and
+    encoding fields of the info are filled in by the writer.
+
+    Returns non-zero on success.
+ */
+int writer_begin( writer* w, sock_t* sock, const http_request* req,
+                  const http_file_info* info );
+
+/* add data to the body, returns non-zero on success */
+int writer_append( writer* w, const char* data, size_t size );
+
+#define writer_puts( w, str ) writer_append( w, str, strlen(str) )
+
+/*
+    Send everything written so far to the client. Has no effect if the
+    client does not support chunked encoding.
+
+    Returns non-zero on success.
+ */
+int writer_flush( writer* w );
+
+/*
+    Finish the body, send what is left and free the writer.
+
+    Returns non-zero if the whole response was sent successfully.
+ */
+int writer_end( writer* w );
+
+#endif /* WRITER_H */
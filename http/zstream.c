@@ -0,0 +1,185 @@
+#include "zstream.h"
+#include "http.h"
+#include "conf.h"
+
+#include <strings.h>
+#include <string.h>
+#include <zlib.h>
+
+/* size of the buffer compressed data is collected in */
+#define ZSTREAM_BUFFER 4096
+
+/* raw deflate stream of the worker, reset for every body */
+static z_stream strm;
+static int strm_level = -1;     /* -1 if not initialized */
+
+static int get_level( const char* type )
+{
+    const cfg_compress* cfg = config_get_compress( );
+    const cfg_level* l;
+    size_t len;
+
+    for( l = cfg->types; l && type; l = l->next )
+    {
+        len = strlen( l->type );
+
+        if( strncasecmp( type, l->type, len ) )
+            continue;
+
+        if( l->type[len - 1] == '/' || !type[len] || type[len] == ';' )
+            return l->level;
+    }
+
+    return cfg->level;
+}
+
+static void put_le32( unsigned char* ptr, unsigned long value )
+{
+    ptr[0] = value & 0xFF;
+    ptr[1] = (value >> 8) & 0xFF;
+    ptr[2] = (value >> 16) & 0xFF;
+    ptr[3] = (value >> 24) & 0xFF;
+}
+
+static int run_deflate( int flush, string* out )
+{
+    unsigned char buffer[ ZSTREAM_BUFFER ];
+    int ret;
+
+    do
+    {
+        strm.next_out = buffer;
+        strm.avail_out = sizeof(buffer);
+
+        ret = deflate( &strm, flush );
+        if( ret == Z_STREAM_ERROR )
+            return 0;
+
+        if( !string_append_len( out, (char*)buffer,
+                                sizeof(buffer) - strm.avail_out ) )
+        {
+            return 0;
+        }
+    }
+    while( strm.avail_out == 0 );
+
+    return flush != Z_FINISH || ret == Z_STREAM_END;
+}
+
+int zstream_choose( int accept, const char* type, size_t size )
+{
+    if( !(accept & (ENC_DEFLATE | ENC_GZIP)) )
+        return 0;
+
+    if( size && size < (size_t)config_get_compress( )->min_size )
+        return 0;
+
+    if( !get_level( type ) )
+        return 0;
+
+    return (accept & ENC_DEFLATE) ? ENC_DEFLATE : ENC_GZIP;
+}
+
+int zstream_begin( zstream* z, int encoding, const char* type, string* out )
+{
+    static const char gzip_header[10] = { 0x1F, (char)0x8B, 8, 0, 0, 0,
+                                          0, 0, 0, 3 };
+    static const char zlib_header[2] = { 0x78, (char)0x9C };
+    int level = get_level( type );
+
+    if( strm_level < 0 )
+    {
+        memset( &strm, 0, sizeof(strm) );
+
+        if( deflateInit2( &strm, level, Z_DEFLATED, -MAX_WBITS, 8,
+                          Z_DEFAULT_STRATEGY ) != Z_OK )
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        deflateReset( &strm );
+
+        if( level != strm_level &&
+            deflateParams( &strm, level, Z_DEFAULT_STRATEGY ) != Z_OK )
+        {
+            return 0;
+        }
+    }
+
+    strm_level = level;
+    z->encoding = encoding;
+    z->size = 0;
+
+    if( encoding == ENC_GZIP )
+    {
+        z->check = crc32( 0, NULL, 0 );
+        return string_append_len( out, gzip_header, sizeof(gzip_header) );
+    }
+
+    z->check = adler32( 0, NULL, 0 );
+    return string_append_len( out, zlib_header, sizeof(zlib_header) );
+}
+
+int zstream_write( zstream* z, const void* data, size_t size, int flush,
+                   string* out )
+{
+    /* the checksum functions return the initial value for NULL */
+    if( size && z->encoding == ENC_GZIP )
+        z->check = crc32( z->check, data, size );
+    else if( size )
+        z->check = adler32( z->check, data, size );
+
+    z->size += size;
+
+    strm.next_in = (Bytef*)data;
+    strm.avail_in = size;
+
+    return run_deflate( flush ? Z_SYNC_FLUSH : Z_NO_FLUSH, out );
+}
+
+int zstream_finish( zstream* z, string* out )
+{
+    unsigned char trailer[8];
+
+    strm.next_in = NULL;
+    strm.avail_in = 0;
+
+    if( !run_deflate( Z_FINISH, out ) )
+        return 0;
+
+    if( z->encoding == ENC_GZIP )
+    {
+        put_le32( trailer, z->check );
+        put_le32( trailer + 4, z->size );
+        return string_append_len( out, (char*)trailer, 8 );
+    }
+
+    trailer[0] = (z->check >> 24) & 0xFF;
+    trailer[1] = (z->check >> 16) & 0xFF;
+    trailer[2] = (z->check >> 8) & 0xFF;
+    trailer[3] = z->check & 0xFF;
+    return string_append_len( out, (char*)trailer, 4 );
+}
+
+int zstream_compress( string* str, int encoding, const char* type )
+{
+    string packed;
+    zstream z;
+
+    if( !string_init_arena( &packed, str->mem ) )
+        return 0;
+
+    if( !zstream_begin( &z, encoding, type, &packed ) ||
+        !zstream_write( &z, str->data, str->used, 0, &packed ) ||
+        !zstream_finish( &z, &packed ) )
+    {
+        string_cleanup( &packed );
+        return 0;
+    }
+
+    string_cleanup( str );
+    string_move( str, &packed );
+    return 1;
+}
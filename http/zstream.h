@@ -0,0 +1,57 @@
+#ifndef ZSTREAM_H
+#define ZSTREAM_H
+
+#include "str.h"
+
+/*
+    State of compressing one response body. The actual compressor is
+    shared by all responses of a worker, so only one body can be
+    compressed at a time.
+ */
+typedef struct
+{
+    int encoding;           /* ENC_DEFLATE or ENC_GZIP */
+    unsigned long check;    /* Adler-32 or CRC-32 of the input so far */
+    unsigned long size;     /* number of input bytes so far */
+}
+zstream;
+
+/*
+    Decide how to encode a response body of a given content type and size
+    (0 if not known yet), based on the encodings accepted by the client and
+    the [compress] section of the configuration.
+
+    Returns ENC_DEFLATE, ENC_GZIP or 0 if the body should be sent as is.
+ */
+int zstream_choose( int accept, const char* type, size_t size );
+
+/*
+    Start compressing a body with an encoding returned by zstream_choose,
+    at the level configured for its content type. The header of the
+    encoding is appended to out.
+
+    Returns non-zero on success.
+ */
+int zstream_begin( zstream* z, int encoding, const char* type, string* out );
+
+/*
+    Compress a piece of the body and append whatever output the compressor
+    produces to out. If flush is non-zero, all data passed in so far is
+    made available for decompression.
+
+    Returns non-zero on success.
+ */
+int zstream_write( zstream* z, const void* data, size_t size, int flush,
+                   string* out );
+
+/* compress the rest of the body and append the trailer to out */
+int zstream_finish( zstream* z, string* out );
+
+/*
+    Replace the content of a string with its compressed form.
+
+    Returns non-zero on success, zero on failure (the string is unchanged).
+ */
+int zstream_compress( string* str, int encoding, const char* type );
+
+#endif /* ZSTREAM_H */
@@ -0,0 +1,60 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* size of the blocks an arena allocates from, unless configured otherwise */
+#define ARENA_BLOCK_SIZE 16384
+
+typedef struct arena_block
+{
+    struct arena_block* next;   /* previously filled block */
+    size_t size;                /* number of bytes in data */
+    size_t used;                /* number of bytes handed out */
+    char data[];
+}
+arena_block;
+
+/*
+    A bump pointer allocator. Memory is handed out from large blocks and
+    only released all at once, by resetting or cleaning up the arena.
+ */
+typedef struct arena
+{
+    arena_block* head;          /* block that is currently allocated from */
+    size_t block_size;          /* minimum size of a new block */
+    void* last;                 /* most recent allocation, can grow in place */
+}
+arena;
+
+/* initialize an empty arena, a block_size of zero uses the default */
+void arena_init( arena* a, size_t block_size );
+
+/*
+    Allocate memory from an arena, suitably aligned for any type.
+
+    Returns NULL if out of memory.
+ */
+void* arena_alloc( arena* a, size_t size );
+
+/*
+    Resize an allocation from an arena. If it was the most recent one and
+    there is enough space left in its block, it is extended in place,
+    otherwise a new allocation is made and the old content copied over.
+
+    Returns NULL if out of memory, in which case the old allocation is
+    still valid.
+ */
+void* arena_realloc( arena* a, void* ptr, size_t oldsize, size_t newsize );
+
+/*
+    Release everything allocated from an arena. The first block is kept
+    (unless it is larger than the block size), so an arena that is reset
+    regularly does not touch the heap once it has warmed up.
+ */
+void arena_reset( arena* a );
+
+/* free all memory of an arena, it can still be used afterwards */
+void arena_cleanup( arena* a );
+
+#endif /* ARENA_H */
@@ -83,18 +83,21 @@ struct js_struct
         }
 
 /*
-    Deserialze a json object from a string string. Returns non-zero on
-    success, zero on failure.
+    Deserialze a json object from a string string. Temporary arrays are
+    allocated from mem if it is not NULL. Returns non-zero on success,
+    zero on failure.
  */
 int json_deserialize( void* obj, const js_struct* desc,
-                      char* str, size_t size );
+                      char* str, size_t size, arena* mem );
 
 /*
     Deserialze a json array and return a pointer to the generated array.
-    Returns non-zero on success, zero on failure.
+    Temporary arrays are allocated from mem if it is not NULL. Returns
+    non-zero on success, zero on failure.
  */
 int json_deserialize_array( void** out, size_t* count,
-                            const js_struct* desc, char* str, size_t size );
+                            const js_struct* desc, char* str, size_t size,
+                            arena* mem );
 
 /* serialize a C struct to JSON an append it to a string */
 int json_serialize( string* str, void* obj, const js_struct* desc );
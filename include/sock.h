@@ -2,13 +2,54 @@
 #define SOCK_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
+
+/* waiting for a new request, no receive buffer allocated */
+#define SOCK_IDLE 0
+
+/* received a part of a request header, waiting for the rest */
+#define SOCK_HEADER 1
+
+/* a request is being processed */
+#define SOCK_BUSY 2
+
+/* received a request header, waiting for the rest of the request body */
+#define SOCK_BODY 3
+
+/* waiting for the socket to take the rest of a response */
+#define SOCK_SENDING 4
+
+/*
+    Upper limit for the output of a connection that is queued in memory.
+    A client that stops reading would otherwise make the worker keep an
+    arbitrarily large response around. If a response does not fit, it
+    fails and the connection has to be closed. File ranges are queued by
+    reference and do not count.
+ */
+#define SOCK_QUEUE_MAX 262144
+
+/* a piece of output that the socket did not take right away */
+typedef struct sock_seg
+{
+    struct sock_seg* next;
+    int filefd;         /* file to send from, -1 if the data follows */
+    off_t offset;       /* position in the file or in data */
+    size_t size;        /* number of bytes left to send */
+    char data[];
+}
+sock_seg;
 
 typedef struct
 {
-    char buffer[128];   /* buffer for buffered reads */
+    char* buffer;       /* SOCK_BUFFER_SIZE bytes, allocated on demand */
     int offset;         /* current read position in buffer */
     int size;           /* number of bytes in buffer */
     int fd;             /* wrapped file discriptor */
+    int state;          /* connection state (SOCK_* value) */
+    sock_seg* out;      /* output waiting to be sent, in order */
+    sock_seg* out_tail; /* last entry of the output queue */
+    size_t queued;      /* bytes of the queue held in memory */
+    int failed;         /* non-zero if output was lost, see sock_send_iov */
 }
 sock_t;
 
@@ -22,15 +63,33 @@ int connect_to( const char* addr, int port, int netproto );
 int wait_for_fd( int fd, long timeoutms );
 
 /*
-    Copy data from a file to a socket via a pipe.
+    Copy data from a file to a non-blocking socket via a pipe.
       pfd: pipe fds 0 -> read end, 1 -> write end
-      filefd: fd to read from
-      sockfd: fd to write to
+      filefd: fd to read from, starting at offset 0 (the file position
+              is not used, so the fd can be shared)
+      sock: socket wrapper to write to
+      offset: the position in the file to start at
       filesize: the number of bytes to transfer
       pipedata: bytes already in the pipe (e.g. http header)
+
+    If the socket cannot take everything right away, the pipe is emptied:
+    the data that was written to it before the transfer is moved to the
+    output queue of the wrapper, followed by the rest of the file, which
+    is sent with sock_flush later on.
+
+    Returns zero on success, non-zero if the transfer was aborted and data
+    might have been left in the pipe.
+ */
+int splice_to_sock( int* pfd, int filefd, sock_t* sock, size_t offset,
+                    size_t filesize, size_t pipedata );
+
+/*
+    Write all buffers of an I/O vector to a file descriptor, continuing
+    after partial writes. The vector is modified in the process.
+
+    Returns non-zero on success, zero on failure.
  */
-void splice_to_sock( int* pfd, int filefd, int sockfd,
-                     size_t filesize, size_t pipedata );
+int write_iov( int fd, struct iovec* iov, int count );
 
 /* create a buffered read wrapper for a file descriptor */
 sock_t* create_wrapper( int fd );
@@ -51,6 +110,32 @@ void destroy_wrapper( sock_t* sock );
  */
 int sock_wait( sock_t* sock, long timeout );
 
+/*
+    Read once from a socket wrapper and append the data to the read buffer.
+    Does not wait, so it should only be used if the socket is known to be
+    readable.
+
+    Returns the number of bytes added on success, zero if end of file was
+    reached or the remote site hung up. Negative if an error happened while
+    reading or if the buffer is already full (errno set to ENOBUFS).
+ */
+int sock_fill( sock_t* sock );
+
+/*
+    Append data that has been received from a socket by other means to the
+    read buffer of its wrapper.
+
+    Returns non-zero on success, zero if the data does not fit into the
+    buffer (errno set to ENOBUFS) or allocating the buffer failed.
+ */
+int sock_append( sock_t* sock, const void* data, size_t size );
+
+/*
+    Free the read buffer of a socket wrapper, if all the data
+    in it has been consumed.
+ */
+void sock_release_buffer( sock_t* sock );
+
 /*
     Read a block of data from a socket wrapper.
 
@@ -64,19 +149,45 @@ int sock_wait( sock_t* sock, long timeout );
 ssize_t sock_read( sock_t* sock, void* buffer, size_t size, long timeoutms );
 
 /*
-    Read a line from a socket (terminated by '\n'). Automatically does the
-    following input transformations:
-      - replace space characters other than '\n' with a normal whitespace
-      - replace backslashes with forward slashes
-      - replace sequences of multiple whitespaces with a single whitespace
-      - replace sequences of slashes with a single slash
-      - trim whitespace at the beginning
-      - trim whitespace at the end
-
-    Returns non-zero on success, zero if connection terminated or out of
-    buffer space, negative if a timeout occoured.
+    Send the buffers of an I/O vector on a non-blocking socket. Whatever
+    the socket does not take right away is copied to the output queue of
+    the wrapper, as is everything if the queue is not empty. The vector
+    is modified in the process.
+
+    Returns non-zero on success, zero on failure, e.g. if the queue would
+    grow beyond SOCK_QUEUE_MAX. After a failure, the failed flag of the
+    wrapper is set and all further output fails, as the client could not
+    make sense of it anymore.
+ */
+int sock_send_iov( sock_t* sock, struct iovec* iov, int count );
+
+/*
+    Send a range of a file on a non-blocking socket with sendfile. If the
+    socket does not take all of it right away, the rest is added to the
+    output queue of the wrapper, with a duplicate of the file descriptor.
+
+    Returns non-zero on success, zero on failure (e.g. if the file is
+    shorter than expected), like sock_send_iov.
+ */
+int sock_send_file( sock_t* sock, int filefd, off_t offset, size_t size );
+
+/*
+    Send as much of the output queue of a socket wrapper as the socket
+    takes without blocking.
+
+    Returns a positive value if the queue is empty, zero if the socket
+    cannot take more for now, a negative value on failure.
+ */
+int sock_flush( sock_t* sock );
+
+/*
+    Remove bytes from the front of the output queue of a socket wrapper,
+    after they have been sent by other means (or, for a file range, moved
+    on towards the socket).
+
+    Returns non-zero if the queue is empty afterwards.
  */
-int read_line( sock_t* sock, char* buffer, size_t size, long timeout );
+int sock_consume( sock_t* sock, size_t size );
 
 #endif /* SOCK_H */
 
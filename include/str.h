@@ -5,11 +5,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+
+/* strings up to this size (including null-terminator) need no allocation */
+#define STRING_INLINE 64
+
 typedef struct
 {
     size_t used;    /* number of chars used (excluding null-terminator) */
     size_t avail;   /* number of chars available in the array */
     char* data;     /* dynamically resized, null-terminated string */
+    arena* mem;     /* where data is allocated from, NULL for the heap */
+    char small[ STRING_INLINE ];    /* initial storage for data */
 }
 string;
 
@@ -20,9 +27,34 @@ typedef struct
 }
 template_map;
 
+/*
+    Initialize an empty string. Short strings are stored inside the string
+    object itself, the array is only allocated once it grows beyond that,
+    doubling its size whenever it runs out of space.
+
+    Returns: non-zero on success, zero on failure.
+ */
 int string_init( string* str );
 
-#define string_cleanup( str ) free((str)->data)
+/*
+    Initialize an empty string that allocates from an arena instead of the
+    heap, e.g. so that all strings of a request are freed in one go. If
+    mem is NULL, this is the same as string_init.
+ */
+int string_init_arena( string* str, arena* mem );
+
+/*
+    Free the data of a string. The string is empty afterwards and can
+    still be used.
+ */
+void string_cleanup( string* str );
+
+/*
+    Move the content of a string over to an uninitialized one. The source
+    must not be used or cleaned up afterwards. Plain assignment does not
+    work, as data may point into the string object itself.
+ */
+void string_move( string* dst, string* src );
 
 int string_append_len( string* str, const char* cstr, size_t len );
 
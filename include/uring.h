@@ -0,0 +1,76 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+typedef struct
+{
+    int fd;                         /* io_uring file descriptor */
+
+    unsigned int* sq_head;          /* submission queue, consumed by kernel */
+    unsigned int* sq_tail;
+    unsigned int* sq_mask;
+    unsigned int* sq_array;
+    unsigned int sq_entries;
+    unsigned int sq_local_tail;     /* tail including unsubmitted entries */
+    struct io_uring_sqe* sqes;
+
+    unsigned int* cq_head;          /* completion queue, filled by kernel */
+    unsigned int* cq_tail;
+    unsigned int* cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ring;                  /* memory mappings of the rings */
+    void* cq_ring;
+    size_t sq_ring_size;
+    size_t cq_ring_size;
+    size_t sqes_size;
+}
+uring_t;
+
+/*
+    Create an io_uring instance with (at least) the given number of
+    submission queue entries.
+
+    Returns non-zero on success, zero on failure (e.g. if the kernel does
+    not support io_uring or a required feature of it).
+ */
+int uring_init( uring_t* ring, unsigned int entries );
+
+/* destroy an io_uring instance */
+void uring_cleanup( uring_t* ring );
+
+/*
+    Get a zero initialized submission queue entry that is submitted with
+    the next call to uring_submit. Returns NULL if the queue is full.
+ */
+struct io_uring_sqe* uring_get_sqe( uring_t* ring );
+
+/*
+    Submit all prepared submission queue entries with a single system call
+    and wait for at least 'wait' completions, or until a timeout in milli
+    seconds expires (negative value means no timeout).
+
+    Returns the number of submitted entries on success, a negated errno
+    value on failure (-ETIME if the timeout expired, -EINTR if a signal
+    was caught).
+ */
+int uring_submit( uring_t* ring, unsigned int wait, long timeoutms );
+
+/* Get the next completion queue entry or NULL if there is none. */
+struct io_uring_cqe* uring_peek_cqe( uring_t* ring );
+
+/* Mark the entry returned by uring_peek_cqe as processed */
+void uring_cqe_seen( uring_t* ring );
+
+/*
+    Check if the kernel supports multishot accepts (Linux 5.19 and later),
+    which io_uring setup itself does not tell. Nothing else may be in
+    flight on the ring.
+
+    Returns non-zero if they are supported.
+ */
+int uring_has_multishot_accept( uring_t* ring );
+
+#endif /* URING_H */